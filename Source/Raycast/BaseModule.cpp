@@ -2,7 +2,55 @@
 
 //#include "Raycast.h"
 #include "BaseModule.h"
+#include "BaseModuleManager.h"
+#include "Engine/World.h"
 
-BaseModule::BaseModule()
+DEFINE_LOG_CATEGORY(BaseModuleLog);
+
+UBaseModule::UBaseModule()
+{
+	PrimaryComponentTick.bCanEverTick = false;
+	PrimaryComponentTick.bStartWithTickEnabled = false;
+}
+
+void UBaseModule::BeginPlay()
+{
+	Super::BeginPlay();
+
+	bModuleActive = bStartActive;
+	if (bModuleActive)
+		FBaseModuleManager::Get(GetWorld())->Register(this);
+}
+void UBaseModule::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	if (TSharedPtr<FBaseModuleManager> manager = FBaseModuleManager::Find(GetWorld()))
+		manager->Unregister(this);
+	bModuleActive = false;
+
+	Super::EndPlay(EndPlayReason);
+}
+
+void UBaseModule::TickModules(const TArray<UBaseModule*>& modules, uint8 * data, float DeltaTime)
+{
+	for (UBaseModule * module : modules)
+		module->TickModule(DeltaTime);
+}
+
+void UBaseModule::SetModuleActive(bool bActive)
 {
+	// Before BeginPlay it only changes what BeginPlay does
+	if (!HasBegunPlay())
+	{
+		bStartActive = bActive;
+		return;
+	}
+
+	if (bModuleActive == bActive)
+		return;
+	bModuleActive = bActive;
+
+	if (bActive)
+		FBaseModuleManager::Get(GetWorld())->Register(this);
+	else if (TSharedPtr<FBaseModuleManager> manager = FBaseModuleManager::Find(GetWorld()))
+		manager->Unregister(this);
 }
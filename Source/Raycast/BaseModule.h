@@ -4,13 +4,72 @@
 
 #include "CoreMinimal.h"
 #include "Runtime/Engine/Classes/Components/ActorComponent.h"
+#include "Containers/ContainerAllocationPolicies.h"
+#include "BaseModule.generated.h"
 
-/**
- * 
+DECLARE_LOG_CATEGORY_EXTERN(BaseModuleLog, Log, All);
+
+DECLARE_STATS_GROUP(TEXT("Modules"), STATGROUP_BaseModules, STATCAT_Advanced);
+
+class UBaseModule;
+
+// Every active module of one class in a world, data of module i is at data + i * dataSize
+struct FBaseModuleBatch
+{
+	UClass * moduleClass = nullptr;
+	TArray<UBaseModule*> modules;
+	TArray<uint8, TAlignedHeapAllocator<16>> data;
+	int32 dataSize = 0;
+};
+
+/** Base of pawn features such as weapons or abilities
+ * Modules don't tick on their own, FBaseModuleManager ticks all active modules of a class in one batch.
+ * Hot per module data can live in the batch, contiguous for the whole class, see GetModuleDataSize
  */
-class RAYCAST_API BaseModule : public UActorComponent
+UCLASS(Abstract)
+class RAYCAST_API UBaseModule : public UActorComponent
 {
-	//GENERATED_BODY()
+	GENERATED_BODY()
 public:
-	BaseModule();
+	UBaseModule();
+
+	// Ticks every active module of this class, called on the class default object
+	virtual void TickModules(const TArray<UBaseModule*>& modules, uint8 * data, float DeltaTime);
+	// Used by default TickModules
+	virtual void TickModule(float DeltaTime) {}
+	// Bytes of batch data per module, the data must be trivially copyable, it's zeroed when module activates
+	virtual int32 GetModuleDataSize() const { return 0; }
+
+	// Batch data of this module, valid while it's active
+	template <typename T>
+	T& GetModuleData()
+	{
+		check(batch && batch->dataSize == sizeof(T));
+		return *(T*)(batch->data.GetData() + batchIndex * batch->dataSize);
+	}
+
+	UFUNCTION(BlueprintCallable, Category = "Module")
+	void SetModuleActive(bool bActive);
+	UFUNCTION(BlueprintCallable, Category = "Module")
+	bool IsModuleActive() const { return bModuleActive; }
+
+	// Pooling, see FBaseModuleManager
+	virtual void OnReturnedToPool() {}
+	virtual void OnTakenFromPool() {}
+	bool IsPooled() const { return bIsPooled; }
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Module")
+	bool bStartActive = true;
+
+protected:
+	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
+private:
+	friend class FBaseModuleManager;
+
+	FBaseModuleBatch * batch = nullptr;
+	int32 batchIndex = INDEX_NONE;
+	bool bModuleActive = false;
+	bool bIsPooled = false;
 };
@@ -0,0 +1,207 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "BaseModuleManager.h"
+#include "Engine/World.h"
+#include "Engine/Level.h"
+#include "GameFramework/Actor.h"
+#include "UObject/Package.h"
+
+DECLARE_CYCLE_STAT(TEXT("Tick modules"), STAT_BaseModuleTick, STATGROUP_BaseModules);
+
+int32 FBaseModuleManager::maxPooledPerClass = 64;
+
+void FBaseModuleTickFunction::ExecuteTick(float DeltaTime, ELevelTick TickType, ENamedThreads::Type CurrentThread, const FGraphEventRef& MyCompletionGraphEvent)
+{
+	if (manager && TickType != LEVELTICK_ViewportsOnly)
+		manager->Tick(DeltaTime);
+}
+
+void FBaseModuleManager::OnWorldReleased()
+{
+	UE_LOG(BaseModuleLog, Log, TEXT("Modules: %d active, %d pooled, %d pool requests, %.1f%% hits"),
+		GetNumActiveModules(), GetNumPooledModules(), poolRequests, GetPoolHitRate() * 100.f);
+}
+
+FBaseModuleManager::FBaseModuleManager(UWorld * world)
+{
+	tickFunction.manager = this;
+	tickFunction.bCanEverTick = true;
+	tickFunction.TickGroup = TG_PrePhysics;
+	if (world && world->PersistentLevel)
+		tickFunction.RegisterTickFunction(world->PersistentLevel);
+}
+FBaseModuleManager::~FBaseModuleManager()
+{
+	if (tickFunction.IsTickFunctionRegistered())
+		tickFunction.UnRegisterTickFunction();
+
+	for (const TUniquePtr<FBaseModuleBatch>& batch : batches)
+		for (UBaseModule * module : batch->modules)
+		{
+			module->batch = nullptr;
+			module->batchIndex = INDEX_NONE;
+		}
+
+	// Nothing references pooled modules anymore
+	for (auto& pooled : pool)
+		for (UBaseModule * module : pooled.Value)
+			if (module)
+				module->MarkPendingKill();
+}
+
+FBaseModuleBatch& FBaseModuleManager::FindOrAddBatch(UClass * moduleClass)
+{
+	if (FBaseModuleBatch ** found = batchesByClass.Find(moduleClass))
+		return **found;
+
+	FBaseModuleBatch * batch = new FBaseModuleBatch();
+	batch->moduleClass = moduleClass;
+	batch->dataSize = Align(moduleClass->GetDefaultObject<UBaseModule>()->GetModuleDataSize(), 4);
+	batches.Add(TUniquePtr<FBaseModuleBatch>(batch));
+	batchesByClass.Add(moduleClass, batch);
+	return *batch;
+}
+
+void FBaseModuleManager::Register(UBaseModule * module)
+{
+	check(module);
+	pendingUnregistrations.RemoveSwap(module);
+	if (module->batch)
+		return;
+	if (bTicking)
+	{
+		pendingRegistrations.AddUnique(module);
+		return;
+	}
+
+	FBaseModuleBatch& batch = FindOrAddBatch(module->GetClass());
+	module->batch = &batch;
+	module->batchIndex = batch.modules.Add(module);
+	batch.data.AddZeroed(batch.dataSize);
+}
+void FBaseModuleManager::Unregister(UBaseModule * module)
+{
+	check(module);
+	pendingRegistrations.RemoveSwap(module);
+	if (!module->batch)
+		return;
+	if (bTicking)
+	{
+		pendingUnregistrations.AddUnique(module);
+		return;
+	}
+
+	// Swap with the last one so batch stays contiguous
+	FBaseModuleBatch& batch = *module->batch;
+	const int32 index = module->batchIndex;
+	const int32 last = batch.modules.Num() - 1;
+	if (index != last)
+	{
+		batch.modules[index] = batch.modules[last];
+		batch.modules[index]->batchIndex = index;
+		if (batch.dataSize > 0)
+			FMemory::Memcpy(batch.data.GetData() + index * batch.dataSize, batch.data.GetData() + last * batch.dataSize, batch.dataSize);
+	}
+	batch.modules.Pop(false);
+	batch.data.SetNum(last * batch.dataSize, false);
+
+	module->batch = nullptr;
+	module->batchIndex = INDEX_NONE;
+}
+
+void FBaseModuleManager::Tick(float DeltaTime)
+{
+	SCOPE_CYCLE_COUNTER(STAT_BaseModuleTick);
+
+	bTicking = true;
+	for (const TUniquePtr<FBaseModuleBatch>& batch : batches)
+		if (batch->modules.Num() > 0)
+			batch->moduleClass->GetDefaultObject<UBaseModule>()->TickModules(batch->modules, batch->data.GetData(), DeltaTime);
+	bTicking = false;
+
+	for (UBaseModule * module : pendingUnregistrations)
+		Unregister(module);
+	pendingUnregistrations.Reset();
+
+	// Register may not queue again now, but take a copy anyway
+	TArray<UBaseModule*> registrations = MoveTemp(pendingRegistrations);
+	pendingRegistrations.Reset();
+	for (UBaseModule * module : registrations)
+		Register(module);
+}
+
+UBaseModule * FBaseModuleManager::AcquireModule(AActor * owner, UClass * moduleClass)
+{
+	check(moduleClass && moduleClass->IsChildOf(UBaseModule::StaticClass()));
+	if (!owner)
+		return nullptr;
+
+	++poolRequests;
+
+	UBaseModule * module = nullptr;
+	if (TArray<UBaseModule*> * pooled = pool.Find(moduleClass))
+		while (!module && pooled->Num() > 0)
+		{
+			module = pooled->Pop(false);
+			if (module && module->IsPendingKill())
+				module = nullptr;
+		}
+
+	if (module)
+	{
+		++poolHits;
+		module->Rename(nullptr, owner, REN_DontCreateRedirectors | REN_ForceNoResetLoaders);
+		module->bIsPooled = false;
+		module->OnTakenFromPool();
+	}
+	else
+		module = NewObject<UBaseModule>(owner, moduleClass);
+
+	// Begins play too if owner already has
+	module->RegisterComponent();
+	return module;
+}
+void FBaseModuleManager::ReleaseModule(UBaseModule * module)
+{
+	if (!module || module->bIsPooled || module->IsPendingKill())
+		return;
+
+	if (module->HasBegunPlay())
+		module->EndPlay(EEndPlayReason::RemovedFromWorld);
+	if (module->IsRegistered())
+		module->UnregisterComponent();
+
+	TArray<UBaseModule*>& pooled = pool.FindOrAdd(module->GetClass());
+	if (pooled.Num() >= maxPooledPerClass)
+	{
+		module->DestroyComponent();
+		return;
+	}
+
+	module->OnReturnedToPool();
+	module->bIsPooled = true;
+	module->Rename(nullptr, GetTransientPackage(), REN_DontCreateRedirectors | REN_ForceNoResetLoaders);
+	pooled.Add(module);
+}
+
+int32 FBaseModuleManager::GetNumActiveModules() const
+{
+	int32 num = 0;
+	for (const TUniquePtr<FBaseModuleBatch>& batch : batches)
+		num += batch->modules.Num();
+	return num;
+}
+int32 FBaseModuleManager::GetNumPooledModules() const
+{
+	int32 num = 0;
+	for (const auto& pooled : pool)
+		num += pooled.Value.Num();
+	return num;
+}
+
+void FBaseModuleManager::AddReferencedObjects(FReferenceCollector& Collector)
+{
+	// Active modules are owned by their actors, pooled ones only by us
+	for (auto& pooled : pool)
+		Collector.AddReferencedObjects(pooled.Value);
+}
@@ -0,0 +1,71 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/EngineBaseTypes.h"
+#include "UObject/GCObject.h"
+#include "CapbotWorldRegistry.h"
+#include "BaseModule.h"
+
+class UWorld;
+class AActor;
+class FBaseModuleManager;
+
+struct FBaseModuleTickFunction : public FTickFunction
+{
+	FBaseModuleManager * manager = nullptr;
+
+	virtual void ExecuteTick(float DeltaTime, ELevelTick TickType, ENamedThreads::Type CurrentThread, const FGraphEventRef& MyCompletionGraphEvent) override;
+	virtual FString DiagnosticMessage() override { return TEXT("FBaseModuleManager::Tick"); }
+};
+
+/** Per-world owner of module batches and the module pool
+ * One tick function per world ticks every batch, a batch is one virtual call for all modules of a class.
+ * Modules (de)activated during the tick are applied after it
+ */
+class RAYCAST_API FBaseModuleManager : public FGCObject, public TCapbotWorldRegistry<FBaseModuleManager>
+{
+public:
+	// Pooled modules kept per class, more are destroyed on release
+	static int32 maxPooledPerClass;
+
+	FBaseModuleManager(UWorld * world);
+	~FBaseModuleManager();
+	// Logs pool stats, the manager goes away with its pool
+	void OnWorldReleased();
+
+	void Register(UBaseModule * module);
+	void Unregister(UBaseModule * module);
+	void Tick(float DeltaTime);
+
+	// Registered module of the class owned by owner, from the pool when one is free
+	UBaseModule * AcquireModule(AActor * owner, UClass * moduleClass);
+	template <typename T>
+	T * AcquireModule(AActor * owner) { return Cast<T>(AcquireModule(owner, T::StaticClass())); }
+	// Ends play of the module and keeps it for next AcquireModule
+	void ReleaseModule(UBaseModule * module);
+
+	int32 GetNumActiveModules() const;
+	int32 GetNumPooledModules() const;
+	float GetPoolHitRate() const { return poolRequests > 0 ? (float)poolHits / poolRequests : 0.f; }
+
+	virtual void AddReferencedObjects(FReferenceCollector& Collector) override;
+
+private:
+	FBaseModuleBatch& FindOrAddBatch(UClass * moduleClass);
+
+	FBaseModuleTickFunction tickFunction;
+
+	// Tick order is the order classes first registered in
+	TArray<TUniquePtr<FBaseModuleBatch>> batches;
+	TMap<UClass*, FBaseModuleBatch*> batchesByClass;
+
+	bool bTicking = false;
+	TArray<UBaseModule*> pendingRegistrations;
+	TArray<UBaseModule*> pendingUnregistrations;
+
+	TMap<UClass*, TArray<UBaseModule*>> pool;
+	int32 poolRequests = 0;
+	int32 poolHits = 0;
+};
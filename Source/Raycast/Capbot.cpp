@@ -4,6 +4,10 @@
 #include "Components/CapsuleComponent.h"
 #include "Components/InputComponent.h"
 #include "Camera/CameraComponent.h"
+#include "Engine/World.h"
+#include "RaycastGameModeBase.h"
+#include "BaseModule.h"
+#include "UnrealNetwork.h"
 
 ACapbot::ACapbot() 
 {
@@ -27,11 +31,25 @@ void ACapbot::BeginPlay()
 	capbotMovement->SetMovementMode(ECapbotMovementModes::CMM_Default);
 	//cameraComponent->SetActive(true);
 	capbotMovement->SetUpdatedComponent(movementComponent);
+
+	// Pre-warmed pool pawns begin play while pooled, clients may get the pooled state with the spawn
+	if (poolState.bIsPooled)
+		ApplyPooledState();
+}
+void ACapbot::SetModulesActive(bool bActive)
+{
+	// Pooled pawn's modules stay out of their batches
+	TInlineComponentArray<UBaseModule*> modules(this);
+	for (UBaseModule * module : modules)
+		if (module->HasBegunPlay())
+			module->SetModuleActive(bActive && module->bStartActive);
 }
 
 void ACapbot::GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const 
 {
 	Super::GetLifetimeReplicatedProps(OutLifetimeProps);
+
+	DOREPLIFETIME(ACapbot, poolState);
 }
 void ACapbot::SetupPlayerInputComponent(UInputComponent* PlayerInputComponent) 
 {
@@ -48,6 +66,59 @@ void ACapbot::PossessedBy(AController * newController)
 void ACapbot::UnPossessed() 
 {
 	Super::UnPossessed();
+
+	// Being destroyed pawns are unpossessed too, those can't be reused
+	if (HasAuthority() && !IsPendingKillPending())
+		if (ARaycastGameModeBase * gameMode = GetWorld()->GetAuthGameMode<ARaycastGameModeBase>())
+			if (gameMode->bRecycleOnUnPossess)
+				gameMode->ReleaseCapbot(this);
+}
+void ACapbot::OnReturnedToPool()
+{
+	poolState.bIsPooled = true;
+	ApplyPooledState();
+
+	// Hidden and collision replicate by themselves, pooled flag goes out before the channel goes dormant
+	SetActorHiddenInGame(true);
+	SetActorEnableCollision(false);
+	SetNetDormancy(DORM_DormantAll);
+}
+void ACapbot::OnTakenFromPool(const FTransform& transform)
+{
+	poolState.bIsPooled = false;
+	++poolState.takenCount;
+	poolState.spawnLocation = transform.GetLocation();
+	poolState.spawnRotation = transform.Rotator();
+
+	SetNetDormancy(DORM_Awake);
+	SetActorHiddenInGame(false);
+	SetActorEnableCollision(true);
+
+	ApplyPooledState();
+}
+void ACapbot::ApplyPooledState()
+{
+	SetActorTickEnabled(!poolState.bIsPooled);
+
+	capbotMovement->SetEnabled(false);
+	// Movement isn't replicated, clients would start from where the pawn was pooled
+	if (!poolState.bIsPooled)
+		SetActorLocationAndRotation(poolState.spawnLocation, poolState.spawnRotation, false, nullptr, ETeleportType::TeleportPhysics);
+	capbotMovement->ResetMovement();
+	if (!poolState.bIsPooled)
+	{
+		cameraVerticalAngle = 0.f;
+		cameraComponent->SetRelativeRotation(FRotator::ZeroRotator);
+		capbotMovement->SetEnabled(true);
+	}
+
+	SetModulesActive(!poolState.bIsPooled);
+}
+void ACapbot::OnRep_PoolState()
+{
+	// Initial replication comes before BeginPlay, which applies it
+	if (HasActorBegunPlay())
+		ApplyPooledState();
 }
 void ACapbot::ForwardInput(float amount) 
 {
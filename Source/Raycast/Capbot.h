@@ -9,6 +9,23 @@ class UCapbotMovementComponent;
 class UCapsuleComponent;
 class UCameraComponent;
 
+// Replicated pool state, a reused pawn starts from its spawn transform on clients too
+USTRUCT()
+struct FCapbotPoolState
+{
+	GENERATED_BODY()
+
+	UPROPERTY()
+	bool bIsPooled = false;
+	// Bumped on every take, so a pawn reused before clients saw it pooled still replicates a change
+	UPROPERTY()
+	uint8 takenCount = 0;
+	UPROPERTY()
+	FVector spawnLocation = FVector::ZeroVector;
+	UPROPERTY()
+	FRotator spawnRotation = FRotator::ZeroRotator;
+};
+
 UCLASS(Blueprintable, BlueprintType)
 class RAYCAST_API ACapbot : public APawn 
 {
@@ -28,6 +45,11 @@ public:
 	UCapbotMovementComponent * GetCapbotMovementComponent() { return capbotMovement; }
 	UCapsuleComponent * GetCapsuleComponent() { return movementComponent; }
 
+	// Pooling, see ARaycastGameModeBase
+	void OnReturnedToPool();
+	void OnTakenFromPool(const FTransform& transform);
+	bool IsPooled() const { return poolState.bIsPooled; }
+
 	UFUNCTION(BlueprintCallable, Category = "Capbot|Input")
 	void ForwardInput(float amount);
 	UFUNCTION(BlueprintCallable, Category = "Capbot|Input")
@@ -51,5 +73,14 @@ private:
 	UPROPERTY(BlueprintReadOnly, VisibleAnywhere, meta=(AllowPrivateAccess = "true"))
 	UCameraComponent * cameraComponent;
 
+	void SetModulesActive(bool bActive);
+	// Local side of pooling, run on every machine
+	void ApplyPooledState();
+	UFUNCTION()
+	void OnRep_PoolState();
+
 	float cameraVerticalAngle;
+	// Replicated so clients stop ticking and simulating pooled pawns too
+	UPROPERTY(ReplicatedUsing = OnRep_PoolState)
+	FCapbotPoolState poolState;
 };
\ No newline at end of file
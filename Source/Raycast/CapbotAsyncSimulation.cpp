@@ -0,0 +1,209 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CapbotAsyncSimulation.h"
+#include "CapbotStaticCollision.h"
+#include "Engine/World.h"
+#include "Engine/Level.h"
+#include "Components/PrimitiveComponent.h"
+
+DECLARE_CYCLE_STAT(TEXT("Async simulation"), STAT_CapbotAsyncSimulation, STATGROUP_CapbotMovement);
+DECLARE_CYCLE_STAT(TEXT("Async simulation sync wait"), STAT_CapbotAsyncSync, STATGROUP_CapbotMovement);
+
+void FCapbotAsyncKickTickFunction::ExecuteTick(float DeltaTime, ELevelTick TickType, ENamedThreads::Type CurrentThread, const FGraphEventRef& MyCompletionGraphEvent)
+{
+	if (simulation && TickType != LEVELTICK_ViewportsOnly)
+		simulation->Kick();
+}
+void FCapbotAsyncSyncTickFunction::ExecuteTick(float DeltaTime, ELevelTick TickType, ENamedThreads::Type CurrentThread, const FGraphEventRef& MyCompletionGraphEvent)
+{
+	if (simulation && TickType != LEVELTICK_ViewportsOnly)
+		simulation->Sync();
+}
+
+FCapbotAsyncSimulation::FCapbotAsyncSimulation(UWorld * inWorld)
+	: world(inWorld)
+{
+	// Components publish during physics, worker runs through post physics and post update work
+	kickTickFunction.simulation = this;
+	kickTickFunction.bCanEverTick = true;
+	kickTickFunction.TickGroup = TG_PostPhysics;
+	syncTickFunction.simulation = this;
+	syncTickFunction.bCanEverTick = true;
+	syncTickFunction.TickGroup = TG_PostUpdateWork;
+	if (world && world->PersistentLevel)
+	{
+		kickTickFunction.RegisterTickFunction(world->PersistentLevel);
+		syncTickFunction.RegisterTickFunction(world->PersistentLevel);
+	}
+}
+FCapbotAsyncSimulation::~FCapbotAsyncSimulation()
+{
+	if (kickTickFunction.IsTickFunctionRegistered())
+		kickTickFunction.UnRegisterTickFunction();
+	if (syncTickFunction.IsTickFunctionRegistered())
+		syncTickFunction.UnRegisterTickFunction();
+
+	// Worker reads baked collision, which is released after this
+	if (task.IsValid())
+		FTaskGraphInterface::Get().WaitUntilTaskCompletes(task);
+}
+
+void FCapbotAsyncSimulation::Kick()
+{
+	if (task.IsValid() || publishedMoves.Num() == 0)
+		return;
+
+	// Shared, a level streaming in rebakes while the worker runs
+	TSharedPtr<FCapbotStaticCollision, ESPMode::ThreadSafe> baked = FCapbotStaticCollision::FindShared(world);
+	if (!baked.IsValid())
+	{
+		// Baked data is gone, components redo their moves at sync
+		for (FCapbotAsyncMove& move : publishedMoves)
+			move.bNeedsGameThread = true;
+		Swap(simulatedMoves, publishedMoves);
+		publishedMoves.Reset();
+		return;
+	}
+
+	Swap(simulatedMoves, publishedMoves);
+	publishedMoves.Reset();
+	simulatedCollision = baked;
+
+	task = FFunctionGraphTask::CreateAndDispatchWhenReady([this, baked]()
+	{
+		SCOPE_CYCLE_COUNTER(STAT_CapbotAsyncSimulation);
+		backResults = simulatedMoves;
+		Simulate(backResults, *baked);
+	}, TStatId(), nullptr, ENamedThreads::AnyThread);
+}
+void FCapbotAsyncSimulation::Sync()
+{
+	if (task.IsValid())
+	{
+		SCOPE_CYCLE_COUNTER(STAT_CapbotAsyncSync);
+		FTaskGraphInterface::Get().WaitUntilTaskCompletes(task);
+		task = nullptr;
+		Swap(frontResults, backResults);
+	}
+	else
+	{
+		// Not kicked to the worker
+		Swap(frontResults, simulatedMoves);
+	}
+	simulatedMoves.Reset();
+
+	for (FCapbotAsyncMove& move : frontResults)
+		if (UCapbotMovementComponent * component = move.component.Get())
+		{
+			move.ground = simulatedCollision.IsValid() ? simulatedCollision->GetComponent(move.groundComponent) : nullptr;
+			component->ApplyAsyncMove(move);
+		}
+	frontResults.Reset();
+	simulatedCollision.Reset();
+}
+
+void FCapbotAsyncSimulation::Simulate(TArray<FCapbotAsyncMove>& moves, const FCapbotStaticCollision& baked)
+{
+	for (FCapbotAsyncMove& move : moves)
+	{
+		switch (move.state.mode)
+		{
+		case ECapbotMovementModes::CMM_Default:
+			SimulateMove<FCapbotDefaultMode>(move, baked);
+			break;
+		case ECapbotMovementModes::CMM_Flying:
+			SimulateMove<FCapbotFlyingMode>(move, baked);
+			break;
+		case ECapbotMovementModes::CMM_Spectator:
+			SimulateMove<FCapbotSpectatorMode>(move, baked);
+			break;
+		default:
+			move.bNeedsGameThread = true;
+			break;
+		}
+	}
+}
+template <typename TMode>
+void FCapbotAsyncSimulation::SimulateMove(FCapbotAsyncMove& move, const FCapbotStaticCollision& baked)
+{
+	FCapbotModeParams params = move.params;
+	if (!TMode::bGravity)
+		params.gravityZ = 0.f;
+
+	CapbotMovementModes::ForEachSubstep(move.input, move.deltaTime, move.maxIterations, move.maxSubstepDeltaTime, [&move, &params, &baked](const FCapbotMovementInput& step, float stepTime)
+	{
+		return SimulateStep<TMode>(move, step, stepTime, params, baked);
+	});
+}
+template <typename TMode>
+bool FCapbotAsyncSimulation::SimulateStep(FCapbotAsyncMove& move, const FCapbotMovementInput& input, float deltaTime, const FCapbotModeParams& params, const FCapbotStaticCollision& baked)
+{
+	FCapbotMovementState& state = move.state;
+
+	TMode::Accelerate(state, input, params, deltaTime);
+	state.rotation += FRotator::MakeFromEuler(input.lookInput);
+
+	const FVector positionDelta = state.velocity * deltaTime;
+
+	state.bIsLanded = false;
+	state.ground = nullptr;
+	move.groundComponent = INDEX_NONE;
+	if (!TMode::bSweep)
+	{
+		state.location += positionDelta;
+		move.velocity = state.velocity;
+	}
+	else if (!positionDelta.IsNearlyZero(1e-6f))
+	{
+		const FVector start = state.location;
+
+		FHitResult hit(1.f);
+		int32 hitComponent = INDEX_NONE;
+		if (!SweepStep(move, positionDelta, hit, hitComponent, baked))
+			return false;
+
+		if (hit.IsValidBlockingHit())
+		{
+			state.velocity -= hit.Normal * FVector::DotProduct(state.velocity, hit.Normal);
+			state.bIsLanded = true;
+			move.groundComponent = hitComponent;
+
+			const FVector slideDelta = FVector::VectorPlaneProject(positionDelta, hit.Normal) * (1.f - hit.Time);
+			if (FVector::DotProduct(slideDelta, positionDelta) > 0.f)
+			{
+				if (!SweepStep(move, slideDelta, hit, hitComponent, baked))
+					return false;
+				if (hit.IsValidBlockingHit())
+					state.velocity -= hit.Normal * FVector::DotProduct(state.velocity, hit.Normal);
+			}
+		}
+
+		move.velocity = (state.location - start) / deltaTime;
+	}
+
+	// Ground is checked again when the move is applied
+	if (TMode::bCanRest && move.restVelocityThreshold >= 0.f && state.bIsLanded && move.groundComponent != INDEX_NONE &&
+		input.moveInput.IsNearlyZero() && input.lookInput.IsNearlyZero() &&
+		(input.flags & ECapbotMovementInputFlags::CMI_Jump) == 0 &&
+		state.velocity.SizeSquared() < move.restVelocityThreshold * move.restVelocityThreshold)
+	{
+		// Rest of the move would be skipped by a resting capbot
+		state.velocity = FVector::ZeroVector;
+		move.velocity = FVector::ZeroVector;
+		move.bEnteredRest = true;
+		return false;
+	}
+
+	return true;
+}
+bool FCapbotAsyncSimulation::SweepStep(FCapbotAsyncMove& move, const FVector& delta, FHitResult& hit, int32& outComponent, const FCapbotStaticCollision& baked)
+{
+	if (!baked.SweepCapsule(hit, outComponent, move.state.location, delta, move.state.rotation.Quaternion(), move.radius, move.halfHeight))
+	{
+		move.bNeedsGameThread = true;
+		return false;
+	}
+
+	move.state.location += delta * hit.Time;
+	return true;
+}
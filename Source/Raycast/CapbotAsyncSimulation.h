@@ -0,0 +1,105 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/EngineBaseTypes.h"
+#include "Async/TaskGraphInterfaces.h"
+#include "CapbotWorldRegistry.h"
+#include "CapbotMovementComponent.h"
+#include "CapbotMovementModes.h"
+
+class UWorld;
+class UPrimitiveComponent;
+class FCapbotStaticCollision;
+class FCapbotAsyncSimulation;
+
+// One server move handed to the worker, state is the result after simulation
+struct FCapbotAsyncMove
+{
+	TWeakObjectPtr<UCapbotMovementComponent> component;
+	// Moves published before a reset of the component are dropped
+	uint32 serial = 0;
+
+	FCapbotMovementState state;
+	FCapbotMovementInput input;
+	float deltaTime = 0.f;
+	FCapbotModeParams params;
+	float radius = 0.f;
+	float halfHeight = 0.f;
+	int32 maxIterations = 1;
+	float maxSubstepDeltaTime = 0.f;
+	// Negative when resting is not allowed
+	float restVelocityThreshold = -1.f;
+
+	// Result
+	FVector velocity = FVector::ZeroVector;
+	// Baked component index, worker never touches UObjects
+	int32 groundComponent = INDEX_NONE;
+	// Resolved from groundComponent at sync, on the game thread
+	TWeakObjectPtr<UPrimitiveComponent> ground;
+	// Baked collision couldn't answer a sweep, move has to be done on the game thread
+	bool bNeedsGameThread = false;
+	bool bEnteredRest = false;
+};
+
+struct FCapbotAsyncKickTickFunction : public FTickFunction
+{
+	FCapbotAsyncSimulation * simulation = nullptr;
+
+	virtual void ExecuteTick(float DeltaTime, ELevelTick TickType, ENamedThreads::Type CurrentThread, const FGraphEventRef& MyCompletionGraphEvent) override;
+	virtual FString DiagnosticMessage() override { return TEXT("FCapbotAsyncSimulation::Kick"); }
+};
+struct FCapbotAsyncSyncTickFunction : public FTickFunction
+{
+	FCapbotAsyncSimulation * simulation = nullptr;
+
+	virtual void ExecuteTick(float DeltaTime, ELevelTick TickType, ENamedThreads::Type CurrentThread, const FGraphEventRef& MyCompletionGraphEvent) override;
+	virtual FString DiagnosticMessage() override { return TEXT("FCapbotAsyncSimulation::Sync"); }
+};
+
+/** Per-world simulation of server-controlled capbots on a worker thread
+ * Components publish their move while ticking, the batch is kicked to a task after physics and
+ * runs while the rest of the frame ticks. Worker only reads the published copies and the baked
+ * static collision, never a UObject; grounds come back as baked indices and are resolved at sync.
+ * Results go to a back buffer that is swapped and applied at the end of the frame.
+ * Dynamic objects are not collided with and impacts aren't reported
+ */
+class RAYCAST_API FCapbotAsyncSimulation : public TCapbotWorldRegistry<FCapbotAsyncSimulation>
+{
+public:
+	FCapbotAsyncSimulation(UWorld * inWorld);
+	~FCapbotAsyncSimulation();
+
+	// Game thread, applied at the next sync
+	void Publish(const FCapbotAsyncMove& move) { publishedMoves.Add(move); }
+
+	void Kick();
+	void Sync();
+
+	int32 NumInFlight() const { return simulatedMoves.Num(); }
+
+private:
+	// Worker, mirrors UCapbotMovementComponent::MoveStep with baked sweeps only
+	template <typename TMode>
+	static void SimulateMove(FCapbotAsyncMove& move, const FCapbotStaticCollision& baked);
+	template <typename TMode>
+	static bool SimulateStep(FCapbotAsyncMove& move, const FCapbotMovementInput& input, float deltaTime, const FCapbotModeParams& params, const FCapbotStaticCollision& baked);
+	static bool SweepStep(FCapbotAsyncMove& move, const FVector& delta, FHitResult& hit, int32& outComponent, const FCapbotStaticCollision& baked);
+	static void Simulate(TArray<FCapbotAsyncMove>& moves, const FCapbotStaticCollision& baked);
+
+	UWorld * world;
+
+	// Published this frame, simulated in flight, back written by the worker, front applied
+	TArray<FCapbotAsyncMove> publishedMoves;
+	TArray<FCapbotAsyncMove> simulatedMoves;
+	TArray<FCapbotAsyncMove> backResults;
+	TArray<FCapbotAsyncMove> frontResults;
+
+	FGraphEventRef task;
+	// Bake the in-flight moves were swept against, their ground indices refer to it
+	TSharedPtr<FCapbotStaticCollision, ESPMode::ThreadSafe> simulatedCollision;
+
+	FCapbotAsyncKickTickFunction kickTickFunction;
+	FCapbotAsyncSyncTickFunction syncTickFunction;
+};
@@ -0,0 +1,64 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CapbotClockSync.h"
+
+void FCapbotClockSync::AddSample(float roundTripTime, float offset)
+{
+	if (roundTripTime < 0.f)
+		return; // Garbage
+
+	const bool bFirstSample = numSamples == 0;
+
+	samples[nextSample].roundTripTime = roundTripTime;
+	samples[nextSample].offset = offset;
+	nextSample = (nextSample + 1) % windowSize;
+	numSamples = FMath::Min(numSamples + 1, windowSize);
+
+	// Clock filter: least delayed sample is the most trustworthy
+	int32 best = (nextSample + windowSize - 1) % windowSize;
+	if (bPickLowestRoundTrip)
+		for (int32 i = 0; i < numSamples; ++i)
+			if (samples[i].roundTripTime < samples[best].roundTripTime)
+				best = i;
+
+	const float bestOffset = samples[best].offset;
+	if (bFirstSample || FMath::Abs(bestOffset - filteredOffset) > maxSlewSeconds)
+		filteredOffset = bestOffset;
+	else
+		filteredOffset = FMath::Lerp(filteredOffset, bestOffset, offsetSmoothing);
+
+	float rttSum = 0.f;
+	float deviationSum = 0.f;
+	for (int32 i = 0; i < numSamples; ++i)
+	{
+		rttSum += samples[i].roundTripTime;
+		deviationSum += FMath::Square(samples[i].offset - filteredOffset);
+	}
+	filteredRoundTripTime = rttSum / numSamples;
+	jitter = FMath::Sqrt(deviationSum / numSamples);
+}
+void FCapbotClockSync::Slew(float deltaTime)
+{
+	if (!IsSynchronized())
+		return;
+
+	if (!bOffsetApplied)
+	{
+		appliedOffset = filteredOffset;
+		bOffsetApplied = true;
+		return;
+	}
+
+	const float maxStep = slewRate * FMath::Max(0.f, deltaTime);
+	appliedOffset += FMath::Clamp(filteredOffset - appliedOffset, -maxStep, maxStep);
+}
+void FCapbotClockSync::Reset()
+{
+	numSamples = 0;
+	nextSample = 0;
+	filteredOffset = 0.f;
+	appliedOffset = 0.f;
+	bOffsetApplied = false;
+	filteredRoundTripTime = 0.f;
+	jitter = 0.f;
+}
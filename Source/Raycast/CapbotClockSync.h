@@ -0,0 +1,56 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/** NTP-like estimator of the offset between a remote clock and the local one
+ * Samples are (round trip time, offset) pairs; the filtered offset is taken from
+ * the lowest-RTT sample in the window since it has the smallest asymmetry error.
+ * Time conversions use an applied offset slewed towards the filtered one, so converted time never goes back
+ */
+struct RAYCAST_API FCapbotClockSync
+{
+	struct FSample
+	{
+		float roundTripTime;
+		float offset;
+	};
+
+	// Amount of samples to pick the best one from
+	static const int32 windowSize = 8;
+	// How fast filtered offset follows the best sample (0..1)
+	float offsetSmoothing = 0.25f;
+	// Offset jumps bigger than this are applied instantly instead of smoothing
+	float maxSlewSeconds = 0.1f;
+	// Max change of applied offset per second, below 1 so converted time keeps moving forward
+	float slewRate = 0.1f;
+	// Off when round trip times of the samples aren't measured locally, newest sample is used then
+	bool bPickLowestRoundTrip = true;
+
+	void AddSample(float roundTripTime, float offset);
+	// Moves applied offset towards filtered offset, first call after synchronizing steps to it
+	void Slew(float deltaTime);
+	void Reset();
+
+	bool IsSynchronized() const { return numSamples > 0; }
+	// remoteTime = localTime + offset
+	float GetOffset() const { return filteredOffset; }
+	float GetRoundTripTime() const { return filteredRoundTripTime; }
+	// Deviation of offsets in the window around filtered offset
+	float GetJitter() const { return jitter; }
+
+	float LocalToRemote(float localTime) const { return localTime + appliedOffset; }
+	float RemoteToLocal(float remoteTime) const { return remoteTime - appliedOffset; }
+
+private:
+	FSample samples[windowSize];
+	int32 numSamples = 0;
+	int32 nextSample = 0;
+
+	float filteredOffset = 0.f;
+	float appliedOffset = 0.f;
+	bool bOffsetApplied = false;
+	float filteredRoundTripTime = 0.f;
+	float jitter = 0.f;
+};
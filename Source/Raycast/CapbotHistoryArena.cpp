@@ -0,0 +1,53 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CapbotHistoryArena.h"
+#include "CapbotMovementComponent.h"
+
+int64 FCapbotHistoryArena::defaultBudgetBytes = 32 * 1024 * 1024;
+
+void FCapbotHistoryArena::OnWorldReleased()
+{
+	UE_LOG(CapbotMovementComponentLog, Log, TEXT("History arena: %lld KB high-water mark, %lld KB reserved, %lld KB budget"),
+		GetHighWaterMark() / 1024, GetBytesReserved() / 1024, GetBudget() / 1024);
+}
+
+FCapbotHistoryArena::~FCapbotHistoryArena()
+{
+	DEC_MEMORY_STAT_BY(STAT_CapbotHistoryMemory, bytesUsed);
+	for (uint8 * slab : slabs)
+		FMemory::Free(slab);
+}
+
+void * FCapbotHistoryArena::AllocateBlock()
+{
+	if (freeBlocks.Num() == 0)
+	{
+		const int64 slabBytes = (int64)blocksPerSlab * blockSize;
+		if (GetBytesReserved() + slabBytes > budgetBytes)
+		{
+			UE_LOG(CapbotMovementComponentLog, Warning, TEXT("History arena budget of %lld KB exhausted"), budgetBytes / 1024);
+			return nullptr;
+		}
+
+		uint8 * slab = (uint8*)FMemory::Malloc(slabBytes, PLATFORM_CACHE_LINE_SIZE);
+		slabs.Add(slab);
+		freeBlocks.Reserve(slabs.Num() * blocksPerSlab);
+		for (int32 i = blocksPerSlab - 1; i >= 0; --i)
+			freeBlocks.Add(slab + i * blockSize);
+	}
+
+	bytesUsed += blockSize;
+	highWaterMark = FMath::Max(highWaterMark, bytesUsed);
+	INC_MEMORY_STAT_BY(STAT_CapbotHistoryMemory, blockSize);
+
+	return freeBlocks.Pop(false);
+}
+void FCapbotHistoryArena::FreeBlock(void * block)
+{
+	if (!block)
+		return;
+
+	bytesUsed -= blockSize;
+	DEC_MEMORY_STAT_BY(STAT_CapbotHistoryMemory, blockSize);
+	freeBlocks.Add(block);
+}
@@ -0,0 +1,128 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "CapbotWorldRegistry.h"
+
+class UWorld;
+
+/** Per-world pool of fixed size blocks for movement and compensation histories
+ * Blocks are carved from big slabs that live as long as the arena, freed blocks
+ * are reused, so memory only grows up to the high-water mark and never past the budget
+ */
+class RAYCAST_API FCapbotHistoryArena : public TCapbotWorldRegistry<FCapbotHistoryArena>
+{
+public:
+	static const int32 blockSize = 4096;
+	static const int32 blocksPerSlab = 64;
+	// Budget for arenas created without explicit one
+	static int64 defaultBudgetBytes;
+
+	// Arena doesn't depend on its world
+	FCapbotHistoryArena(const UWorld *) {}
+	~FCapbotHistoryArena();
+	// Logs usage, memory goes away with the last history using the arena
+	void OnWorldReleased();
+
+	// Returns nullptr when budget is exhausted
+	void * AllocateBlock();
+	void FreeBlock(void * block);
+
+	void SetBudget(int64 bytes) { budgetBytes = bytes; }
+	int64 GetBudget() const { return budgetBytes; }
+	// Bytes in blocks given out
+	int64 GetBytesUsed() const { return bytesUsed; }
+	int64 GetHighWaterMark() const { return highWaterMark; }
+	// Bytes reserved in slabs
+	int64 GetBytesReserved() const { return (int64)slabs.Num() * blocksPerSlab * blockSize; }
+	int32 GetNumSlabAllocations() const { return slabs.Num(); }
+
+private:
+	TArray<uint8*> slabs;
+	TArray<void*> freeBlocks;
+
+	int64 budgetBytes = defaultBudgetBytes;
+	int64 bytesUsed = 0;
+	int64 highWaterMark = 0;
+};
+
+/** Fixed capacity array living in one arena block, for trivially copyable elements
+ * Capacity is what fits the block (or less if asked), adding to a full history fails
+ */
+template <typename T>
+class TCapbotHistory
+{
+	TSharedPtr<FCapbotHistoryArena> arena;
+	T * data = nullptr;
+	int32 num = 0;
+	int32 capacity = 0;
+
+public:
+	TCapbotHistory() {}
+	TCapbotHistory(const TCapbotHistory&) = delete;
+	TCapbotHistory& operator=(const TCapbotHistory&) = delete;
+	~TCapbotHistory() { Free(); }
+
+	bool Allocate(const TSharedPtr<FCapbotHistoryArena>& inArena, int32 maxElements)
+	{
+		static_assert(sizeof(T) <= FCapbotHistoryArena::blockSize, "History element does not fit arena block");
+		Free();
+		if (!inArena.IsValid())
+			return false;
+
+		data = (T*)inArena->AllocateBlock();
+		if (!data)
+			return false;
+
+		arena = inArena;
+		capacity = FMath::Min(maxElements, FCapbotHistoryArena::blockSize / (int32)sizeof(T));
+		return true;
+	}
+	void Free()
+	{
+		if (data && arena.IsValid())
+			arena->FreeBlock(data);
+		arena.Reset();
+		data = nullptr;
+		num = 0;
+		capacity = 0;
+	}
+
+	bool IsAllocated() const { return data != nullptr; }
+	int32 Num() const { return num; }
+	int32 Max() const { return capacity; }
+	SIZE_T GetAllocatedSize() const { return data ? FCapbotHistoryArena::blockSize : 0; }
+
+	T& operator[](int32 index) { check(index >= 0 && index < num); return data[index]; }
+	const T& operator[](int32 index) const { check(index >= 0 && index < num); return data[index]; }
+	T& Last() { return (*this)[num - 1]; }
+	const T& Last() const { return (*this)[num - 1]; }
+
+	bool Add(const T& element)
+	{
+		if (num >= capacity)
+			return false;
+		data[num++] = element;
+		return true;
+	}
+	void RemoveAt(int32 index)
+	{
+		check(index >= 0 && index < num);
+		FMemory::Memmove(data + index, data + index + 1, (num - index - 1) * sizeof(T));
+		--num;
+	}
+	template <typename Predicate>
+	int32 RemoveAll(const Predicate& predicate)
+	{
+		int32 kept = 0;
+		for (int32 i = 0; i < num; ++i)
+			if (!predicate(data[i]))
+				data[kept++] = data[i];
+		const int32 removed = num - kept;
+		num = kept;
+		return removed;
+	}
+	// Empties, keeps the block
+	void Reset() { num = 0; }
+};
@@ -1,6 +1,10 @@
 // Fill out your copyright notice in the Description page of Project Settings.
 
 #include "CapbotMovementComponent.h"
+#include "CapbotStaticCollision.h"
+#include "CapbotMovementLOD.h"
+#include "CapbotMovementModes.h"
+#include "CapbotAsyncSimulation.h"
 #include "Engine/World.h"
 #include "Components/PrimitiveComponent.h"
 #include "Kismet/GameplayStatics.h"
@@ -8,6 +12,19 @@
 #include "UnrealNetwork.h"
 
 DEFINE_LOG_CATEGORY(CapbotMovementComponentLog);
+DEFINE_STAT(STAT_RestingCapbots);
+DEFINE_STAT(STAT_CapbotHistoryMemory);
+DEFINE_STAT(STAT_ReducedLODCapbots);
+
+
+// Estimated RPC payloads for net telemetry, an object reference counts as a 4 byte net GUID
+static const int32 stateRPCBytes = 4 + 3 * 12 + 1 + 1;
+static const int32 inputRPCBytes = 1 + 2 * 12 + 4 + 4 + 1;
+static const int32 timeStampRPCBytes = 4;
+
+// Simulated proxy playback: states kept at most, and how fast render time eases back to its delay (1/s)
+static const int32 maxRemoteStates = 32;
+static const float remoteTimeCorrectionRate = 2.f;
 
 void FCapbotMovementState_Server::ApplyMovementState(const FCapbotMovementState& movementState, float timeStamp) 
 {
@@ -34,17 +51,27 @@ FCapbotMovementState FCapbotMovementState_Server::Interpolate(const FCapbotMovem
 	}
 	else 
 	{
-		float alpha = (time - a.timeStamp) / (b.timeStamp - a.timeStamp);
-		FCapbotMovementState newState;
-		newState.ground = a.movementState.ground;
-		newState.bIsLanded = a.movementState.bIsLanded;
-		newState.location = FMath::Lerp(a.movementState.location, b.movementState.location, alpha);
-		newState.rotation = FMath::Lerp(a.movementState.rotation, b.movementState.rotation, alpha);
-		newState.velocity = FMath::Lerp(a.movementState.velocity, b.movementState.velocity, alpha);
-		newState.mode = a.movementState.mode;
+		const float deltaSeconds = b.timeStamp - a.timeStamp;
+		return InterpolateStates(a.movementState, b.movementState, (time - a.timeStamp) / deltaSeconds, deltaSeconds);
+	}
+}
+FCapbotMovementState FCapbotMovementState_Server::InterpolateStates(const FCapbotMovementState& a, const FCapbotMovementState& b, float alpha, float deltaSeconds)
+{
+	FCapbotMovementState newState;
+	newState.ground = a.ground;
+	newState.bIsLanded = a.bIsLanded;
+	newState.mode = a.mode;
+	newState.rotation = FQuat::Slerp(a.rotation.Quaternion(), b.rotation.Quaternion(), alpha).Rotator();
 
-		return newState;
+	if (a.mode != b.mode)
+	{
+		newState.location = FMath::Lerp(a.location, b.location, alpha);
+		newState.velocity = FMath::Lerp(a.velocity, b.velocity, alpha);
 	}
+	else
+		CapbotInterpolation::InterpolateMotion(a.location, a.velocity, b.location, b.velocity, alpha, deltaSeconds, newState.location, newState.velocity);
+
+	return newState;
 }
 
 UCapbotMovementComponent::UCapbotMovementComponent()
@@ -57,6 +84,39 @@ UCapbotMovementComponent::UCapbotMovementComponent()
 void UCapbotMovementComponent::BeginPlay()
 {
 	Super::BeginPlay();
+
+	movementLOD = FCapbotMovementLOD::Get(GetWorld());
+	lodPhase = movementLOD->AssignPhase();
+	RegisterCompensateable(GetCompensateableWorld());
+
+	groundRegistry = FCapbotGroundRegistry::Get(GetWorld());
+
+	// Fixed size from the start, history never reallocates while playing.
+	// Server keeps moves, the owning client its inputs (see TickClientOwner), simulated proxies neither
+	if (GetOwner()->HasAuthority())
+	{
+		if (!serverMovementSaved.Allocate(FCapbotHistoryArena::Get(GetWorld()), maxSavedMovementSize))
+			UE_LOG(CapbotMovementComponentLog, Warning, TEXT("%s: no history memory, moves won't be reconciled"), *GetPathName());
+
+		compensationHistory.maxMemoryTimeSeconds = maxCompensationSeconds;
+		if (!compensationHistory.Allocate(GetWorld()))
+			UE_LOG(CapbotMovementComponentLog, Warning, TEXT("%s: no history memory, pawn won't be lag compensated"), *GetPathName());
+	}
+}
+void UCapbotMovementComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	SetResting(false);
+	SetLODReduced(false);
+	UnregisterCompensateable();
+	serverMovementSaved.Free();
+	clientInputSaved.Free();
+	bInputHistoryRequested = false;
+	compensationHistory.Free();
+	groundRegistry.Reset();
+	movementLOD.Reset();
+	++asyncMoveSerial;
+	bAsyncMovePending = false;
+	Super::EndPlay(EndPlayReason);
 }
 void UCapbotMovementComponent::NormalizeInput() 
 {
@@ -72,12 +132,64 @@ void UCapbotMovementComponent::SetEnabled(bool bNewEnabled)
 		return;
 
 	bEnabled = bNewEnabled;
+	if (!bEnabled)
+	{
+		SetResting(false);
+		SetLODReduced(false);
+		lodSkippedTime = 0.f;
+	}
 }
 void UCapbotMovementComponent::SetMovementMode(ECapbotMovementModes newMode) 
 {
 	currentMovementState.mode = newMode;
 }
 
+void UCapbotMovementComponent::ResetMovement()
+{
+	SetResting(false);
+	ResetInput();
+
+	const ECapbotMovementModes mode = currentMovementState.mode;
+	currentMovementState = FCapbotMovementState();
+	currentMovementState.mode = mode;
+	if (UpdatedComponent)
+	{
+		currentMovementState.location = UpdatedComponent->GetComponentLocation();
+		currentMovementState.rotation = UpdatedComponent->GetComponentRotation();
+	}
+	Velocity = FVector::ZeroVector;
+
+	serverMovementSaved.Reset();
+	clientInputSaved.Reset();
+	compensationHistory.Reset();
+	serverLastClientMovement = FCapbotMovementState_Server();
+	bClientMoveReceived = false;
+	clientInputTime = 0.f;
+
+	lodSkippedTime = 0.f;
+	lodFullRateUntil = 0.f;
+	SetLODReduced(false);
+
+	bHasPendingMove = false;
+	// Move in flight is dropped when it comes back
+	++asyncMoveSerial;
+	bAsyncMovePending = false;
+	lastRemoteUpdateTime = -1.f;
+	remoteStates.Reset();
+	remoteRenderTime = -1.f;
+	netStats = FCapbotNetStats();
+	lastReceivedInputTimeStamp = -1.f;
+
+	clockSync.Reset();
+	clockSyncTimer = 0.f;
+}
+FCapbotNetStats UCapbotMovementComponent::TakeNetStats()
+{
+	const FCapbotNetStats stats = netStats;
+	netStats = FCapbotNetStats();
+	return stats;
+}
+
 void UCapbotMovementComponent::TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)
 {
 	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
@@ -109,13 +221,165 @@ void UCapbotMovementComponent::TickComponent(float DeltaTime, ELevelTick TickTyp
 	}
 }
 
-void UCapbotMovementComponent::TickServerOwner(float DeltaTime)
+void UCapbotMovementComponent::TickServerOwner(float DeltaTime, bool bAllowAsync)
 {
+	// Input keeps accumulating over skipped frames
+	if (UpdateMovementLOD(DeltaTime))
+		return;
+
+	StampInputEvents(DeltaTime);
 	NormalizeInput();
+
+	// Simulated on the worker and applied at the sync point, see FCapbotAsyncSimulation
+	if (bAsyncSimulation && bAllowAsync && PublishAsyncMove(DeltaTime))
+	{
+		ResetInput();
+		return;
+	}
+
+	// Published move started from the state this one moves on from, its time goes into this one
+	DeltaTime += CancelAsyncMove();
+
+	const bool bWasResting = bIsResting;
 	PerformMovement(accumulatedInput, DeltaTime);
-	MulticastSendMoveResult(currentMovementState, accumulatedInput);
+	FinishServerMove(bWasResting);
 	ResetInput();
 }
+void UCapbotMovementComponent::FinishServerMove(bool bWasResting)
+{
+	SaveCompensationPose();
+	if (ShouldSendRemoteUpdate(bWasResting))
+	{
+		MulticastSendMoveResult(currentMovementState, GetWorld()->TimeSeconds);
+		netStats.rpcBytesOut += stateRPCBytes + timeStampRPCBytes;
+	}
+}
+bool UCapbotMovementComponent::PublishAsyncMove(float DeltaTime)
+{
+	// Player's own pawn on a listen server needs its move before the camera updates
+	APawn * pawn = Cast<APawn>(GetOwner());
+	if (bAsyncMovePending || !pawn || pawn->IsPlayerControlled() || !bUseBakedStaticCollision || !UpdatedPrimitive)
+		return false;
+	if (currentMovementState.mode == ECapbotMovementModes::CMM_NONE || !UpdatedPrimitive->GetCollisionShape().IsCapsule())
+		return false;
+
+	TSharedPtr<FCapbotAsyncSimulation> simulation = FCapbotAsyncSimulation::Find(GetWorld());
+	if (!simulation.IsValid() || !FCapbotStaticCollision::Find(GetWorld()))
+		return false;
+
+	// Waking up looks at the ground component, it's done here
+	if (bIsResting)
+	{
+		if (!ShouldWakeUp(accumulatedInput))
+			return true;
+		SetResting(false);
+	}
+
+	const FCollisionShape shape = UpdatedPrimitive->GetCollisionShape();
+
+	FCapbotAsyncMove move;
+	move.component = this;
+	move.serial = asyncMoveSerial;
+	move.state = currentMovementState;
+	move.input = accumulatedInput;
+	move.deltaTime = DeltaTime;
+	move.params = MakeModeParams();
+	move.radius = shape.GetCapsuleRadius();
+	move.halfHeight = shape.GetCapsuleHalfHeight();
+	move.maxIterations = maxIterations;
+	move.maxSubstepDeltaTime = maxSubstepDeltaTime;
+	move.restVelocityThreshold = bAllowResting ? restVelocityThreshold : -1.f;
+	move.velocity = Velocity;
+	simulation->Publish(move);
+
+	bAsyncMovePending = true;
+	asyncMoveDeltaTime = DeltaTime;
+	return true;
+}
+void UCapbotMovementComponent::ApplyAsyncMove(const FCapbotAsyncMove& move)
+{
+	if (move.serial != asyncMoveSerial || !bAsyncMovePending)
+		return;
+	bAsyncMovePending = false;
+	if (!bEnabled || !UpdatedComponent)
+		return;
+
+	// Baked collision couldn't answer, nothing has moved since publishing so the move is redone here
+	if (move.bNeedsGameThread)
+	{
+		PerformMovement(move.input, move.deltaTime);
+		FinishServerMove(false);
+		return;
+	}
+
+	currentMovementState = move.state;
+	currentMovementState.ground = move.ground.Get();
+	UpdatedComponent->SetWorldLocationAndRotation(currentMovementState.location, currentMovementState.rotation, false);
+	Velocity = move.velocity;
+
+	// Worker only knew the baked index, the ground may be gone by now
+	if (move.bEnteredRest && IsValid(currentMovementState.ground))
+	{
+		restGroundTransform = currentMovementState.ground->GetComponentTransform();
+		SetResting(true);
+	}
+
+	FinishServerMove(false);
+}
+float UCapbotMovementComponent::CancelAsyncMove()
+{
+	if (!bAsyncMovePending)
+		return 0.f;
+
+	++asyncMoveSerial;
+	bAsyncMovePending = false;
+	return asyncMoveDeltaTime;
+}
+bool UCapbotMovementComponent::UpdateMovementLOD(float& DeltaTime)
+{
+	bool bReduce = false;
+	if (bAllowMovementLOD && lodReducedRate > 1 && GetWorld()->TimeSeconds >= lodFullRateUntil)
+	{
+		const float distanceSquared = movementLOD->GetClosestViewerDistanceSquared(UpdatedComponent->GetComponentLocation());
+		const float reducedDistance = FMath::Min(lodReducedDistance, FMath::Sqrt(GetOwner()->NetCullDistanceSquared));
+		// Hysteresis keeps pawns from flickering on the border: promoted at reducedDistance, demoted only past the margin
+		const float threshold = bLODReduced ? reducedDistance : reducedDistance + lodPromotionMargin;
+		bReduce = distanceSquared > FMath::Square(threshold);
+	}
+	SetLODReduced(bReduce);
+
+	lodSkippedTime += DeltaTime;
+	if (bLODReduced && (GFrameCounter + lodPhase) % lodReducedRate != 0)
+		return true;
+
+	DeltaTime = lodSkippedTime;
+	lodSkippedTime = 0.f;
+	return false;
+}
+void UCapbotMovementComponent::SetLODReduced(bool bNewReduced)
+{
+	if (bNewReduced == bLODReduced)
+		return;
+
+	bLODReduced = bNewReduced;
+	if (bLODReduced)
+		INC_DWORD_STAT(STAT_ReducedLODCapbots);
+	else
+		DEC_DWORD_STAT(STAT_ReducedLODCapbots);
+}
+void UCapbotMovementComponent::PromoteMovementLOD()
+{
+	if (UWorld * world = GetWorld())
+		lodFullRateUntil = world->TimeSeconds + lodPromotionSeconds;
+
+	if (!bLODReduced && !bAsyncMovePending)
+		return;
+
+	SetLODReduced(false);
+	// Caller looks at the pose right after, it can't wait for the worker
+	if ((lodSkippedTime > 0.f || bAsyncMovePending) && bEnabled && UpdatedComponent)
+		TickServerOwner(0.f, false);
+}
 void UCapbotMovementComponent::TickServerRemote(float DeltaTime, bool bSyncTimeStamp)
 {
 	/*if (bInputReceived)
@@ -124,93 +388,313 @@ void UCapbotMovementComponent::TickServerRemote(float DeltaTime, bool bSyncTimeS
 		return;
 	}*/
 	NormalizeInput();
+	// Client's input decides the time here, a move in flight is only dropped
+	CancelAsyncMove();
 
+	const bool bWasResting = bIsResting;
 	PerformMovement(accumulatedInput, accumulatedInput.deltaTime);
-	MulticastSendMoveResult(currentMovementState, accumulatedInput);
+	FinishServerMove(bWasResting);
 
 	if (bSyncTimeStamp)
 		clientInputTime = accumulatedInput.timeStamp;
 	//else
 	//	clientInputTime += DeltaTime;
 
-	if (serverMovementSaved.Num() < maxSavedMovementSize)
-		serverMovementSaved.Push(FCapbotMovementState_Server::Make(currentMovementState, clientInputTime));
+	// Newest state is always kept, older ones every historySampleInterval, Hermite interpolation fills the rest
+	const FCapbotCompactState saved = FCapbotCompactState::Make(currentMovementState, clientInputTime, *groundRegistry);
+	const int32 savedNum = serverMovementSaved.Num();
+	if (savedNum >= 2 && saved.timeStamp - serverMovementSaved[savedNum - 2].timeStamp < historySampleInterval)
+		serverMovementSaved.Last() = saved;
+	else if (savedNum < maxSavedMovementSize)
+		serverMovementSaved.Add(saved);
+}
+bool UCapbotMovementComponent::ShouldSendRemoteUpdate(bool bWasResting)
+{
+	if (bWasResting && bIsResting)
+		return false;
+
+	// Last state before sleep is always sent so remotes settle at the same spot
+	const float now = GetWorld()->TimeSeconds;
+	if (!bIsResting && lastRemoteUpdateTime >= 0.f && now - lastRemoteUpdateTime < remoteUpdateInterval)
+		return false;
+
+	lastRemoteUpdateTime = now;
+	return true;
 }
 void UCapbotMovementComponent::TickClientOwner(float DeltaTime)
 {
+	// Possession reaches the client after BeginPlay
+	if (!bInputHistoryRequested)
+	{
+		bInputHistoryRequested = true;
+		if (!clientInputSaved.Allocate(FCapbotHistoryArena::Get(GetWorld()), maxSavedInputSize))
+			UE_LOG(CapbotMovementComponentLog, Warning, TEXT("%s: no history memory, moves won't be reconciled"), *GetPathName());
+	}
+
+	clockSyncTimer -= DeltaTime;
+	if (clockSyncTimer <= 0.f)
+	{
+		clockSyncTimer = clockSyncInterval;
+		ServerClockPing(GetWorld()->TimeSeconds, clockSync.GetRoundTripTime());
+		netStats.rpcBytesOut += 2 * timeStampRPCBytes;
+	}
+
+	StampInputEvents(DeltaTime);
 	NormalizeInput();
 
-	accumulatedInput.timeStamp = GetWorld()->TimeSeconds;
+	// Stamps would be in client timeline, moves wait for the first pong
+	clockSync.Slew(DeltaTime);
+	if (!clockSync.IsSynchronized())
+	{
+		ResetInput();
+		return;
+	}
+
+	// Nothing to simulate or to tell the server about
+	if (bIsResting && !ShouldWakeUp(accumulatedInput))
+	{
+		FlushPendingMove();
+		ResetInput();
+		return;
+	}
+
+	// Stamp in server timeline, slewed offset keeps it going forward
+	accumulatedInput.timeStamp = GetServerTime();
 	accumulatedInput.deltaTime = DeltaTime;
+	// Simulate with exactly what replay history will hold
+	FCapbotCompactInput::Quantize(accumulatedInput);
 
-	ServerSendMoveResult(currentMovementState, GetWorld()->TimeSeconds);
-	ServerSendInput(accumulatedInput);
+	if (bHasPendingMove && CanCombineMoves(pendingMove, accumulatedInput))
+	{
+		// One longer move, the server will simulate exactly that
+		pendingMove.lookInput += accumulatedInput.lookInput;
+		pendingMove.timeStamp = accumulatedInput.timeStamp;
+		pendingMove.deltaTime += accumulatedInput.deltaTime;
+		FCapbotCompactInput::Quantize(pendingMove);
+	}
+	else
+	{
+		FlushPendingMove();
+
+		pendingMove = accumulatedInput;
+		BeginPendingMove();
+	}
+
+	SimulatePendingMove();
+
+	if (!bCombineMoves || pendingMove.deltaTime >= maxCombinedMoveDeltaTime)
+		FlushPendingMove();
 
-	PerformMovement(accumulatedInput, DeltaTime);
-	if (clientInputSaved.Num() < maxSavedInputSize)
-		clientInputSaved.Push(accumulatedInput);
 	ResetInput();
 }
+bool UCapbotMovementComponent::CanCombineMoves(const FCapbotMovementInput& pending, const FCapbotMovementInput& next) const
+{
+	if (!bCombineMoves)
+		return false;
+	if (pending.deltaTime + next.deltaTime > maxCombinedMoveDeltaTime)
+		return false;
+	// Jump presses have their own timing inside the move
+	if (pending.flags != next.flags || (next.flags & ECapbotMovementInputFlags::CMI_Jump) > 0)
+		return false;
+	// Substeps of the combined move have to stay maxSubstepDeltaTime long, see SimulatePendingMove
+	if (maxSubstepDeltaTime <= 0.f || pending.deltaTime + next.deltaTime > maxSubstepDeltaTime * FMath::Max(1, maxIterations))
+		return false;
+
+	return pending.moveInput.Equals(next.moveInput, combineMoveTolerance);
+}
+void UCapbotMovementComponent::BeginPendingMove()
+{
+	pendingMoveStartState = currentMovementState;
+	bPendingMoveStartResting = bIsResting;
+	pendingMoveStartTime = 0.f;
+	pendingMoveStartLook = FVector::ZeroVector;
+	pendingMoveSimulatedTime = 0.f;
+	bHasPendingMove = true;
+}
+void UCapbotMovementComponent::SimulatePendingMove()
+{
+	// Never combined, simulated once as a whole
+	if ((pendingMove.flags & ECapbotMovementInputFlags::CMI_Jump) > 0 || maxSubstepDeltaTime <= 0.f ||
+		pendingMove.deltaTime > maxSubstepDeltaTime * FMath::Max(1, maxIterations))
+	{
+		PerformMovement(pendingMove, pendingMove.deltaTime);
+		pendingMoveSimulatedTime = pendingMove.deltaTime;
+		return;
+	}
+
+	// Previous slice ended inside a substep, which the server simulates in one piece
+	if (pendingMoveSimulatedTime != pendingMoveStartTime)
+	{
+		ApplyMovementState(pendingMoveStartState);
+		SetResting(bPendingMoveStartResting);
+	}
+
+	// Same steps ForEachSubstep takes over the whole move: full ones, then the rest.
+	// Look input only turns the capsule, what's left of it is spread over what's left of the move
+	const float remainingTime = pendingMove.deltaTime - pendingMoveStartTime;
+	const FVector remainingLook = pendingMove.lookInput - pendingMoveStartLook;
+	FCapbotMovementInput step = pendingMove;
+	float time = pendingMoveStartTime;
+	while (pendingMove.deltaTime - time > maxSubstepDeltaTime + KINDA_SMALL_NUMBER)
+	{
+		step.lookInput = remainingLook * (maxSubstepDeltaTime / remainingTime);
+		PerformMovement(step, maxSubstepDeltaTime);
+		time += maxSubstepDeltaTime;
+
+		pendingMoveStartState = currentMovementState;
+		bPendingMoveStartResting = bIsResting;
+		pendingMoveStartTime = time;
+		pendingMoveStartLook += step.lookInput;
+	}
+
+	const float restTime = pendingMove.deltaTime - time;
+	if (restTime > KINDA_SMALL_NUMBER)
+	{
+		step.lookInput = pendingMove.lookInput - pendingMoveStartLook;
+		PerformMovement(step, restTime);
+		time += restTime;
+	}
+	pendingMoveSimulatedTime = time;
+}
+void UCapbotMovementComponent::FlushPendingMove()
+{
+	if (!bHasPendingMove)
+		return;
+	bHasPendingMove = false;
+
+	// Input first, the server has simulated it by the time the result is checked
+	ServerSendInput(pendingMove);
+	ServerSendMoveResult(currentMovementState, pendingMove.timeStamp);
+	netStats.rpcBytesOut += inputRPCBytes + stateRPCBytes + timeStampRPCBytes;
+
+	if (clientInputSaved.Num() < maxSavedInputSize)
+		clientInputSaved.Add(FCapbotCompactInput::Make(pendingMove));
+}
 void UCapbotMovementComponent::TickClientRemote(float DeltaTime)
 {
-	PerformMovement(accumulatedInput, DeltaTime);
+	// Pawn is no longer ours, input history goes back to the arena
+	if (bInputHistoryRequested)
+	{
+		clientInputSaved.Free();
+		bInputHistoryRequested = false;
+	}
+
+	if (remoteStates.Num() == 0)
+		return;
+
+	// Render time follows the newest state remoteInterpolationDelay behind, easing out arrival jitter
+	const float targetTime = remoteStates.Last().timeStamp - remoteInterpolationDelay;
+	if (remoteRenderTime < 0.f || FMath::Abs(targetTime - (remoteRenderTime + DeltaTime)) > remoteInterpolationDelay)
+		remoteRenderTime = targetTime;
+	else
+		remoteRenderTime += DeltaTime + (targetTime - (remoteRenderTime + DeltaTime)) * FMath::Min(1.f, DeltaTime * remoteTimeCorrectionRate);
+
+	// Only the last state before render time is needed
+	int32 first = 0;
+	while (first + 1 < remoteStates.Num() && remoteStates[first + 1].timeStamp <= remoteRenderTime)
+		++first;
+	if (first > 0)
+		remoteStates.RemoveAt(0, first, false);
+
+	// Past the newest state (rest, lost packets) the pawn stays there
+	const FCapbotMovementState state = remoteStates.Num() >= 2 ?
+		FCapbotMovementState_Server::Interpolate(remoteStates[0], remoteStates[1], remoteRenderTime) : remoteStates[0].movementState;
+	ApplyMovementState(state);
+	Velocity = state.velocity;
 }
 
 bool UCapbotMovementComponent::PerformMovement(const FCapbotMovementInput& input, float deltaTime)
 {
+	// Every sweep of the move would look it up otherwise
+	moveBakedCollision = bUseBakedStaticCollision ? FCapbotStaticCollision::Find(GetWorld()) : nullptr;
+
+	bool bMoved = false;
 	switch (currentMovementState.mode)
 	{
 	case ECapbotMovementModes::CMM_Default:
-		DefaultMove(input, deltaTime);
-		return true;
+		bMoved = PerformMovementMode<FCapbotDefaultMode>(input, deltaTime);
+		break;
+	case ECapbotMovementModes::CMM_Flying:
+		bMoved = PerformMovementMode<FCapbotFlyingMode>(input, deltaTime);
+		break;
+	case ECapbotMovementModes::CMM_Spectator:
+		bMoved = PerformMovementMode<FCapbotSpectatorMode>(input, deltaTime);
+		break;
 	default:
-		return false;
+		break;
 	}
+
+	moveBakedCollision = nullptr;
+	return bMoved;
 }
-void UCapbotMovementComponent::DefaultMove(const FCapbotMovementInput& input, float deltaTime)
+template <typename TMode>
+bool UCapbotMovementComponent::PerformMovementMode(const FCapbotMovementInput& input, float deltaTime)
 {
-	UWorld * world = GetWorld();
-	
-	/* Perform acceleration routine */
-	// Standart movement
-	if (!input.moveInput.IsNearlyZero())
-	{
-		currentMovementState.velocity += input.moveInput * acceleration * deltaTime;
-	}
-	else if (currentMovementState.bIsLanded)
-	{
-		float decelerationValue = deceleration * deltaTime;
-		if (currentMovementState.velocity.SizeSquared() < decelerationValue * decelerationValue)
-			currentMovementState.velocity = FVector::ZeroVector;
-		else
-			currentMovementState.velocity -= currentMovementState.velocity.GetUnsafeNormal() * decelerationValue;
-	}
-	// Gravity
-	if (world) if (AWorldSettings * settings = world->GetWorldSettings()) 
-		currentMovementState.velocity += FVector(0, 0, settings->GetGravityZ() * deltaTime);
-	// Jump
-	if (currentMovementState.bIsLanded) if ((input.flags & ECapbotMovementInputFlags::CMI_Jump) > 0)
-		currentMovementState.velocity += FVector(0, 0, jumpVelocity);
+	FCapbotModeParams params = MakeModeParams();
+	if (!TMode::bGravity)
+		params.gravityZ = 0.f;
+
+	CapbotMovementModes::ForEachSubstep(input, deltaTime, maxIterations, maxSubstepDeltaTime, [this, &params](const FCapbotMovementInput& step, float stepTime)
+	{
+		MoveStep<TMode>(step, stepTime, params);
+		return true;
+	});
+
+	return true;
+}
+FCapbotModeParams UCapbotMovementComponent::MakeModeParams() const
+{
+	FCapbotModeParams params;
+	params.acceleration = acceleration;
+	params.deceleration = deceleration;
+	params.maxMovementSpeed = maxMovementSpeed;
+	params.jumpVelocity = jumpVelocity;
+	params.gravityZ = 0.f;
+	if (UWorld * world = GetWorld())
+		if (AWorldSettings * settings = world->GetWorldSettings())
+			params.gravityZ = settings->GetGravityZ();
+
+	return params;
+}
+template <typename TMode>
+FORCEINLINE void UCapbotMovementComponent::MoveStep(const FCapbotMovementInput& input, float deltaTime, const FCapbotModeParams& params)
+{
+	if (TMode::bCanRest && bIsResting)
+	{
+		if (!ShouldWakeUp(input))
+			return;
+		SetResting(false);
+	}
+
+	TMode::Accelerate(currentMovementState, input, params, deltaTime);
 	//Look
 	currentMovementState.rotation += FRotator::MakeFromEuler(input.lookInput);
 
 	FVector positionDelta = currentMovementState.velocity * deltaTime;
 
 	currentMovementState.bIsLanded = false;
+	currentMovementState.ground = nullptr;
 	bPositionCorrected = false;
-	if (!positionDelta.IsNearlyZero(1e-6f))
+	if (!TMode::bSweep)
+	{
+		currentMovementState.location = UpdatedComponent->GetComponentLocation() + positionDelta;
+		UpdatedComponent->SetWorldLocationAndRotation(currentMovementState.location, currentMovementState.rotation, false);
+		Velocity = currentMovementState.velocity;
+	}
+	else if (!positionDelta.IsNearlyZero(1e-6f))
 	{
 		currentMovementState.location = UpdatedComponent->GetComponentLocation();
 
 		FHitResult hit(1.f);
-		SafeMoveUpdatedComponent(positionDelta, currentMovementState.rotation, true, hit);
+		MoveCapbot(positionDelta, currentMovementState.rotation, hit);
 
 		if (hit.IsValidBlockingHit())
 		{
 			currentMovementState.velocity -= hit.Normal * FVector::DotProduct(currentMovementState.velocity, hit.Normal);
 			currentMovementState.bIsLanded = true;
+			currentMovementState.ground = hit.GetComponent();
 			HandleImpact(hit, deltaTime, positionDelta);
-			SlideAlongSurface(positionDelta, 1.f - hit.Time, hit.Normal, hit, true);
+			SlideCapbot(positionDelta, 1.f - hit.Time, hit.Normal, hit);
 			if (hit.IsValidBlockingHit()) 
 				currentMovementState.velocity -= hit.Normal * FVector::DotProduct(currentMovementState.velocity, hit.Normal);
 		}
@@ -223,6 +707,69 @@ void UCapbotMovementComponent::DefaultMove(const FCapbotMovementInput& input, fl
 
 		currentMovementState.location = UpdatedComponent->GetComponentLocation();
 	}
+
+	if (TMode::bCanRest && bAllowResting && currentMovementState.bIsLanded && IsValid(currentMovementState.ground) &&
+		input.moveInput.IsNearlyZero() && input.lookInput.IsNearlyZero() &&
+		(input.flags & ECapbotMovementInputFlags::CMI_Jump) == 0 &&
+		currentMovementState.velocity.SizeSquared() < restVelocityThreshold * restVelocityThreshold)
+	{
+		currentMovementState.velocity = FVector::ZeroVector;
+		Velocity = FVector::ZeroVector;
+		restGroundTransform = currentMovementState.ground->GetComponentTransform();
+		SetResting(true);
+	}
+}
+void UCapbotMovementComponent::MoveCapbot(const FVector& delta, const FRotator& rotation, FHitResult& hit)
+{
+	if (!MoveWithBakedCollision(delta, rotation.Quaternion(), hit))
+		SafeMoveUpdatedComponent(delta, rotation, true, hit);
+}
+void UCapbotMovementComponent::SlideCapbot(const FVector& delta, float time, const FVector& normal, FHitResult& hit)
+{
+	if (!moveBakedCollision)
+	{
+		SlideAlongSurface(delta, time, normal, hit, true);
+		return;
+	}
+
+	const FVector slideDelta = ComputeSlideVector(delta, time, normal, hit);
+	if (FVector::DotProduct(slideDelta, delta) > 0.f)
+		MoveCapbot(slideDelta, currentMovementState.rotation, hit);
+}
+bool UCapbotMovementComponent::MoveWithBakedCollision(const FVector& delta, const FQuat& rotation, FHitResult& hit)
+{
+	FCapbotStaticCollision * baked = moveBakedCollision;
+	if (!baked || !UpdatedPrimitive)
+		return false;
+
+	UWorld * world = GetWorld();
+
+	const FCollisionShape shape = UpdatedPrimitive->GetCollisionShape();
+	if (!shape.IsCapsule())
+		return false;
+
+	const FVector start = UpdatedComponent->GetComponentLocation();
+
+	FHitResult staticHit;
+	if (!baked->SweepCapsule(staticHit, start, delta, rotation, shape.GetCapsuleRadius(), shape.GetCapsuleHalfHeight()))
+		return false;
+
+	// Static geometry is answered, physics scene only has to look at movable objects if there are any
+	FHitResult dynamicHit(1.f);
+	if (baked->HasMovableBlockers(GetOwner()))
+	{
+		FCollisionQueryParams q;
+		q.AddIgnoredActor(GetOwner());
+		q.MobilityType = EQueryMobilityType::Dynamic;
+
+		world->SweepSingleByProfile(dynamicHit, start, start + delta, rotation, UpdatedPrimitive->GetCollisionProfileName(), shape, q);
+		if (dynamicHit.bStartPenetrating)
+			return false;
+	}
+
+	hit = dynamicHit.bBlockingHit && dynamicHit.Time < staticHit.Time ? dynamicHit : staticHit;
+	UpdatedComponent->SetWorldLocationAndRotation(start + delta * hit.Time, rotation, false);
+	return true;
 }
 bool UCapbotMovementComponent::TracePrimitiveDefault(FHitResult& hit, FCapbotMovementState& fromState, float deltaTime)
 {
@@ -248,9 +795,42 @@ void UCapbotMovementComponent::ApplyMovementState(const FCapbotMovementState& ne
 		return;
 
 	currentMovementState = newState;
+	SetResting(false);
 
 	UpdatedComponent->SetWorldLocationAndRotation(currentMovementState.location, currentMovementState.rotation);
 }
+bool UCapbotMovementComponent::ShouldWakeUp(const FCapbotMovementInput& input) const
+{
+	if (!input.moveInput.IsNearlyZero() || !input.lookInput.IsNearlyZero())
+		return true;
+	if ((input.flags & ECapbotMovementInputFlags::CMI_Jump) > 0)
+		return true;
+
+	// Ground has gone or moved under our feet
+	USceneComponent * ground = currentMovementState.ground;
+	if (!IsValid(ground))
+		return true;
+	return !ground->GetComponentTransform().Equals(restGroundTransform);
+}
+void UCapbotMovementComponent::SetResting(bool bNewResting)
+{
+	if (bNewResting == bIsResting)
+		return;
+
+	bIsResting = bNewResting;
+	if (bIsResting)
+	{
+		if (movementLOD.IsValid())
+			movementLOD->AddResting(1);
+		INC_DWORD_STAT(STAT_RestingCapbots);
+	}
+	else
+	{
+		if (movementLOD.IsValid())
+			movementLOD->AddResting(-1);
+		DEC_DWORD_STAT(STAT_RestingCapbots);
+	}
+}
 bool UCapbotMovementComponent::ResolvePenetrationImpl(const FVector& Adjustment, const FHitResult& Hit, const FQuat& NewRotation) 
 {
 	bPositionCorrected |= Super::ResolvePenetrationImpl(Adjustment, Hit, NewRotation);
@@ -268,22 +848,122 @@ void UCapbotMovementComponent::AddLookInput(FVector input)
 void UCapbotMovementComponent::DoJumpInput() 
 {
 	accumulatedInput.flags |= (int8)ECapbotMovementInputFlags::CMI_Jump;
+	pendingJumpTime = 0.0;
+}
+void UCapbotMovementComponent::DoJumpInputAt(double platformTime)
+{
+	// Untimed press earlier this frame already starts the move
+	const bool bUntimedPress = (accumulatedInput.flags & ECapbotMovementInputFlags::CMI_Jump) > 0 && pendingJumpTime == 0.0;
+	accumulatedInput.flags |= (int8)ECapbotMovementInputFlags::CMI_Jump;
+	if (!bUntimedPress && (pendingJumpTime == 0.0 || platformTime < pendingJumpTime))
+		pendingJumpTime = platformTime;
+}
+void UCapbotMovementComponent::StampInputEvents(float DeltaTime)
+{
+	// Untimed presses keep fraction 0
+	if (pendingJumpTime != 0.0 && DeltaTime > 0.f)
+	{
+		// Frame covers [now - DeltaTime, now], earlier presses start the move
+		const double frameStart = FPlatformTime::Seconds() - DeltaTime;
+		const float fraction = FMath::Clamp((float)((pendingJumpTime - frameStart) / DeltaTime), 0.f, 1.f);
+		accumulatedInput.jumpFraction = (uint8)FMath::RoundToInt(fraction * 255.f);
+	}
+	pendingJumpTime = 0.0;
 }
 void UCapbotMovementComponent::AddInput(FCapbotMovementInput input) 
 {
 	accumulatedInput.moveInput += input.moveInput;
 	accumulatedInput.lookInput += input.lookInput;
+	if ((input.flags & ECapbotMovementInputFlags::CMI_Jump) > 0)
+		accumulatedInput.jumpFraction = (accumulatedInput.flags & ECapbotMovementInputFlags::CMI_Jump) > 0 ?
+			FMath::Min(accumulatedInput.jumpFraction, input.jumpFraction) : input.jumpFraction;
 	accumulatedInput.flags |= input.flags;
 	accumulatedInput.timeStamp = FMath::Max(accumulatedInput.timeStamp, input.timeStamp);
 }
 
+int32 UCapbotMovementComponent::GetNumRestingCapbots(const UWorld * world)
+{
+	TSharedPtr<FCapbotMovementLOD> lod = FCapbotMovementLOD::Find(world);
+	return lod.IsValid() ? lod->GetNumResting() : 0;
+}
+float UCapbotMovementComponent::GetServerTime() const
+{
+	UWorld * world = GetWorld();
+	if (!world)
+		return 0.f;
+
+	if (GetOwner() && GetOwner()->HasAuthority())
+		return world->TimeSeconds;
+
+	return clockSync.LocalToRemote(world->TimeSeconds);
+}
+float UCapbotMovementComponent::GetViewServerTime() const
+{
+	if (GetOwner() && GetOwner()->HasAuthority())
+		return GetServerTime();
+
+	return GetServerTime() - clockSync.GetRoundTripTime() * 0.5f - remoteInterpolationDelay;
+}
+float UCapbotMovementComponent::GetCompensationSeconds(float timeStamp) const
+{
+	return FMath::Max(0.f, GetServerTime() - timeStamp);
+}
+
+void UCapbotMovementComponent::SaveCompensationPose()
+{
+	FCapbotCompensationPose pose;
+	pose.location = currentMovementState.location;
+	pose.velocity = currentMovementState.velocity;
+	compensationHistory.Save(pose, GetWorld()->TimeSeconds);
+}
 void UCapbotMovementComponent::CompensateSeconds(float amount) 
 {
+	if (!UpdatedComponent)
+		return;
+	// Pose has to be exact before anyone looks at it
+	PromoteMovementLOD();
 
+	preCompensationLocation = UpdatedComponent->GetComponentLocation();
+	if (compensationHistory.Num() > 0)
+		UpdatedComponent->SetWorldLocation(compensationHistory.Get(GetWorld()->TimeSeconds - amount).location, false, nullptr, ETeleportType::TeleportPhysics);
 }
 void UCapbotMovementComponent::RevertCompensation() 
 {
+	if (UpdatedComponent)
+		UpdatedComponent->SetWorldLocation(preCompensationLocation, false, nullptr, ETeleportType::TeleportPhysics);
+}
+bool UCapbotMovementComponent::GetCompensatedCapsule(float worldTime, FVector& outCenter, float& outRadius, float& outHalfHeight)
+{
+	if (!UpdatedPrimitive || !bEnabled)
+		return false;
+	// Reduced LOD pawn lags behind its history
+	PromoteMovementLOD();
+
+	const FCollisionShape shape = UpdatedPrimitive->GetCollisionShape();
+	if (!shape.IsCapsule())
+		return false;
+
+	outRadius = shape.GetCapsuleRadius();
+	outHalfHeight = shape.GetCapsuleHalfHeight();
+	outCenter = worldTime < GetWorld()->TimeSeconds && compensationHistory.Num() > 0 ?
+		compensationHistory.Get(worldTime).location : UpdatedComponent->GetComponentLocation();
+	return true;
+}
+bool UCapbotMovementComponent::GetCompensatedBounds(float fromWorldTime, FBox& outBounds)
+{
+	if (!UpdatedPrimitive || !bEnabled)
+		return false;
+	// Reduced LOD pawn lags behind its history
+	PromoteMovementLOD();
 
+	outBounds = FBox(ForceInit);
+	outBounds += UpdatedComponent->GetComponentLocation();
+	compensationHistory.ForEachSince(fromWorldTime, [&outBounds](float, const FCapbotCompensationPose& pose) { outBounds += pose.location; });
+
+	// Hermite curve stays near its points, margin covers the overshoot
+	const FCollisionShape shape = UpdatedPrimitive->GetCollisionShape();
+	outBounds = outBounds.ExpandBy(shape.GetExtent() + FVector(maxMovementSpeed * 0.1f));
+	return true;
 }
 
 bool UCapbotMovementComponent::ServerSendInput_Validate(FCapbotMovementInput input)
@@ -292,6 +972,17 @@ bool UCapbotMovementComponent::ServerSendInput_Validate(FCapbotMovementInput inp
 }
 void UCapbotMovementComponent::ServerSendInput_Implementation(FCapbotMovementInput input)
 {
+	++netStats.inputsReceived;
+	netStats.rpcBytesIn += inputRPCBytes;
+	// Input covers deltaTime before its stamp, a hole before that is lost input, unless the pawn was resting
+	if (lastReceivedInputTimeStamp >= 0.f && !bIsResting && input.deltaTime > 0.f)
+	{
+		const float gap = input.timeStamp - input.deltaTime - lastReceivedInputTimeStamp;
+		if (gap > input.deltaTime * 0.5f)
+			netStats.missingInputs += FMath::Max(1, FMath::RoundToInt(gap / input.deltaTime));
+	}
+	lastReceivedInputTimeStamp = FMath::Max(lastReceivedInputTimeStamp, input.timeStamp);
+
 	accumulatedInput = input;
 	// Perform movement in-place
 	if (APawn * pawn = Cast<APawn>(GetOwner()))
@@ -307,6 +998,7 @@ bool UCapbotMovementComponent::ServerSendMoveResult_Validate(FCapbotMovementStat
 { return true; }
 void UCapbotMovementComponent::ServerSendMoveResult_Implementation(FCapbotMovementState result, float timeStamp)
 {
+	netStats.rpcBytesIn += stateRPCBytes + timeStampRPCBytes;
 	if (timeStamp >= serverLastClientMovement.timeStamp) 
 	{
 		int savedNum = serverMovementSaved.Num();
@@ -323,22 +1015,11 @@ void UCapbotMovementComponent::ServerSendMoveResult_Implementation(FCapbotMoveme
 			if (!FMath::IsNearlyEqual(serverLastClientMovement.timeStamp, timeStamp, 0.001f))
 				return;
 
-			float offset = (serverMovementSaved[0].movementState.location - result.location).Size();
-			DrawDebugCapsule(GetWorld(), serverMovementSaved[0].movementState.location, 56.f, 30.f, FQuat::Identity, FColor::Yellow);
-			if (offset > maxAcceptableOffset)
-			{
-				ClientCorrectMove(serverMovementSaved[0].movementState, timeStamp);
-				if (GEngine)
-					GEngine->AddOnScreenDebugMessage(-1, 0.0f, FColor::Red, "Correct move (" + FString::SanitizeFloat(offset) + "): " + FString::SanitizeFloat(timeStamp));
-			}
-			else
-			{
-				ClientAckGoodMove(timeStamp);
-				if (GEngine)
-					GEngine->AddOnScreenDebugMessage(-1, 0.0f, FColor::Green, "Ack good move(" + FString::SanitizeFloat(offset) + "): " + FString::SanitizeFloat(timeStamp));
-			}
+			const FCapbotMovementState savedState = serverMovementSaved[0].Expand(*groundRegistry).movementState;
+			DrawDebugCapsule(GetWorld(), savedState.location, 56.f, 30.f, FQuat::Identity, FColor::Yellow);
+			CheckClientMove(savedState, result, timeStamp);
 
-			serverMovementSaved.RemoveAll([timeStamp](const FCapbotMovementState_Server& elem) { return elem.timeStamp < timeStamp; });
+			serverMovementSaved.RemoveAll([timeStamp](const FCapbotCompactState& elem) { return elem.timeStamp < timeStamp; });
 			return;
 		}
 
@@ -347,24 +1028,39 @@ void UCapbotMovementComponent::ServerSendMoveResult_Implementation(FCapbotMoveme
 			if (serverMovementSaved[i].timeStamp <= timeStamp)
 				break;
 
-		FCapbotMovementState interpolatedState = FCapbotMovementState_Server::Interpolate(serverMovementSaved[i], serverMovementSaved[i + 1], timeStamp);
+		FCapbotMovementState interpolatedState = FCapbotMovementState_Server::Interpolate(serverMovementSaved[i].Expand(*groundRegistry), serverMovementSaved[i + 1].Expand(*groundRegistry), timeStamp);
 		DrawDebugCapsule(GetWorld(), interpolatedState.location, 56.f, 30.f, FQuat::Identity, FColor::Blue);
 
-		float offset = (interpolatedState.location - result.location).Size();
-		if (offset > maxAcceptableOffset)
-		{
-			ClientCorrectMove(interpolatedState, timeStamp);
-			if (GEngine)
-				GEngine->AddOnScreenDebugMessage(-1, 0.0f, FColor::Red, "Correct move (" + FString::SanitizeFloat(offset) + "): " + FString::SanitizeFloat(timeStamp));
-		}
-		else
-		{
-			ClientAckGoodMove(timeStamp);
-			if (GEngine)
-				GEngine->AddOnScreenDebugMessage(-1, 0.0f, FColor::Green, "Ack good move(" + FString::SanitizeFloat(offset) + "): " + FString::SanitizeFloat(timeStamp));
-		}
+		CheckClientMove(interpolatedState, result, timeStamp);
+
+		serverMovementSaved.RemoveAll([timeStamp](const FCapbotCompactState& elem) { return elem.timeStamp < timeStamp; });
+	}
+}
+void UCapbotMovementComponent::CheckClientMove(const FCapbotMovementState& serverState, const FCapbotMovementState& result, float timeStamp)
+{
+	float offset = (serverState.location - result.location).Size();
+	if (offset > maxAcceptableOffset)
+	{
+		ClientCorrectMove(serverState, timeStamp);
+		++netStats.correctedMoves;
+		netStats.correctionOffsetSum += offset;
+		netStats.rpcBytesOut += stateRPCBytes + timeStampRPCBytes;
+		// Client replays what it sent after the corrected move
+		for (int32 i = 0; i < serverMovementSaved.Num(); ++i)
+			if (serverMovementSaved[i].timeStamp > timeStamp)
+				++netStats.replayedMoves;
 
-		serverMovementSaved.RemoveAll([timeStamp](const FCapbotMovementState_Server& elem) { return elem.timeStamp < timeStamp; });
+		if (GEngine)
+			GEngine->AddOnScreenDebugMessage(-1, 0.0f, FColor::Red, "Correct move (" + FString::SanitizeFloat(offset) + "): " + FString::SanitizeFloat(timeStamp));
+	}
+	else
+	{
+		ClientAckGoodMove(timeStamp);
+		++netStats.ackedMoves;
+		netStats.rpcBytesOut += timeStampRPCBytes;
+
+		if (GEngine)
+			GEngine->AddOnScreenDebugMessage(-1, 0.0f, FColor::Green, "Ack good move(" + FString::SanitizeFloat(offset) + "): " + FString::SanitizeFloat(timeStamp));
 	}
 }
 void UCapbotMovementComponent::ClientSendMoveResult_Implementation(FCapbotMovementState result)
@@ -373,7 +1069,9 @@ void UCapbotMovementComponent::ClientSendMoveResult_Implementation(FCapbotMoveme
 }
 void UCapbotMovementComponent::ClientAckGoodMove_Implementation(float timeStamp) 
 {
-	clientInputSaved.RemoveAll([timeStamp](const FCapbotMovementInput& elem) { return elem.timeStamp < timeStamp; });
+	++netStats.ackedMoves;
+	netStats.rpcBytesIn += timeStampRPCBytes;
+	clientInputSaved.RemoveAll([timeStamp](const FCapbotCompactInput& elem) { return elem.timeStamp < timeStamp; });
 }
 void UCapbotMovementComponent::ClientCorrectMove_Implementation(FCapbotMovementState newState, float timeStamp)
 {
@@ -381,16 +1079,27 @@ void UCapbotMovementComponent::ClientCorrectMove_Implementation(FCapbotMovementS
 		if (!pawn->IsLocallyControlled())
 			return; // Nop for not-my-pawn
 
+	++netStats.correctedMoves;
+	netStats.rpcBytesIn += stateRPCBytes + timeStampRPCBytes;
+
 	int index = clientInputSaved.Num() - 1;
 	for (; index >= 0; --index)
 		if (clientInputSaved[index].timeStamp <= timeStamp) // Condition == is important AF
 		{
 			ApplyMovementState(newState);
+			netStats.replayedMoves += clientInputSaved.Num() - index;
 
 			for (; index < clientInputSaved.Num(); ++index)
-				PerformMovement(clientInputSaved[index], clientInputSaved[index].deltaTime);
+				PerformMovement(clientInputSaved[index].Expand(), clientInputSaved[index].deltaTime);
+
+			clientInputSaved.Reset();
 
-			clientInputSaved.Empty();
+			// Not yet sent move goes on top of corrected state
+			if (bHasPendingMove)
+			{
+				BeginPendingMove();
+				SimulatePendingMove();
+			}
 
 			return;
 		}
@@ -398,12 +1107,41 @@ void UCapbotMovementComponent::ClientCorrectMove_Implementation(FCapbotMovementS
 	if (GEngine)
 		GEngine->AddOnScreenDebugMessage(-1, 0.0f, FColor::Yellow, "No replay data");
 }
-void UCapbotMovementComponent::MulticastSendMoveResult_Implementation(FCapbotMovementState result, FCapbotMovementInput input)
+void UCapbotMovementComponent::MulticastSendMoveResult_Implementation(FCapbotMovementState result, float timeStamp)
 {
-	if (APawn * pawn = Cast<APawn>(GetOwner()))
-		if (!pawn->IsLocallyControlled())
-	{
-		ApplyMovementState(result);
-		accumulatedInput = input;
-	}
+	// Played back by TickClientRemote, unreliable states arriving late are dropped
+	if (GetOwnerRole() != ROLE_SimulatedProxy)
+		return;
+	if (remoteStates.Num() > 0 && timeStamp <= remoteStates.Last().timeStamp)
+		return;
+
+	if (remoteStates.Num() >= maxRemoteStates)
+		remoteStates.RemoveAt(0, 1, false);
+	remoteStates.Add(FCapbotMovementState_Server::Make(result, timeStamp));
+}
+bool UCapbotMovementComponent::ServerClockPing_Validate(float clientTime, float roundTripTime)
+{
+	return roundTripTime >= 0.f;
+}
+void UCapbotMovementComponent::ServerClockPing_Implementation(float clientTime, float roundTripTime)
+{
+	const float serverTime = GetWorld()->TimeSeconds;
+	netStats.rpcBytesIn += 2 * timeStampRPCBytes;
+	netStats.rpcBytesOut += 2 * timeStampRPCBytes;
+
+	// Client reports its filtered RTT, zero until it got the first pong.
+	// It's a mean over the client window, picking the lowest one here would mean nothing
+	clockSync.bPickLowestRoundTrip = false;
+	if (roundTripTime > 0.f)
+		clockSync.AddSample(roundTripTime, clientTime + roundTripTime * 0.5f - serverTime);
+
+	ClientClockPong(clientTime, serverTime);
+}
+void UCapbotMovementComponent::ClientClockPong_Implementation(float clientTime, float serverTime)
+{
+	const float now = GetWorld()->TimeSeconds;
+	const float roundTripTime = now - clientTime;
+	netStats.rpcBytesIn += 2 * timeStampRPCBytes;
+
+	clockSync.AddSample(roundTripTime, serverTime + roundTripTime * 0.5f - now);
 }
\ No newline at end of file
@@ -5,15 +5,29 @@
 #include "CoreMinimal.h"
 #include "GameFramework/PawnMovementComponent.h"
 #include "FLagCompensateable.h"
+#include "CapbotClockSync.h"
+#include "CapbotMovementHistory.h"
+#include "CapbotHistoryArena.h"
+#include "CapbotNetTelemetry.h"
 #include "CapbotMovementComponent.generated.h"
 
 DECLARE_LOG_CATEGORY_EXTERN(CapbotMovementComponentLog, Log, All);
 
+struct FCapbotModeParams;
+struct FCapbotAsyncMove;
+class FCapbotMovementLOD;
+class FCapbotStaticCollision;
+
+DECLARE_STATS_GROUP(TEXT("CapbotMovement"), STATGROUP_CapbotMovement, STATCAT_Advanced);
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Resting Capbots"), STAT_RestingCapbots, STATGROUP_CapbotMovement, RAYCAST_API);
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Reduced LOD Capbots"), STAT_ReducedLODCapbots, STATGROUP_CapbotMovement, RAYCAST_API);
+DECLARE_MEMORY_STAT_EXTERN(TEXT("History arena used"), STAT_CapbotHistoryMemory, STATGROUP_CapbotMovement, RAYCAST_API);
+
 
 UENUM(BlueprintType)
 enum class ECapbotMovementModes : uint8
 {
-	CMM_NONE, CMM_Default
+	CMM_NONE, CMM_Default, CMM_Flying, CMM_Spectator
 };
 enum ECapbotMovementInputFlags : uint8
 {
@@ -63,6 +77,10 @@ struct FCapbotMovementInput
 	UPROPERTY()
 	float deltaTime;
 
+	// Moment of the jump press inside the move, in 1/255 of deltaTime
+	UPROPERTY()
+	uint8 jumpFraction = 0;
+
 	inline bool IsEmpty() { return timeStamp == -1.f; }
 };
 
@@ -81,7 +99,16 @@ struct FCapbotMovementState_Server
 
 	static FCapbotMovementState_Server Make(const FCapbotMovementState& movementState, float timeStamp);
 	static FCapbotMovementState Interpolate(const FCapbotMovementState_Server& a, const FCapbotMovementState_Server& b, float time);
+	/* Cubic Hermite location using saved velocities as tangents, slerped rotation
+	* Falls back to linear location when the states don't look like one continuous move (teleport, reset)
+	*/
+	static FCapbotMovementState InterpolateStates(const FCapbotMovementState& a, const FCapbotMovementState& b, float alpha, float deltaSeconds);
 };
+// TCompensationDataMemory<FCapbotMovementState> interpolation
+inline FCapbotMovementState InterpolateCompensationData(const FCapbotMovementState& a, const FCapbotMovementState& b, float alpha, float deltaSeconds)
+{
+	return FCapbotMovementState_Server::InterpolateStates(a, b, alpha, deltaSeconds);
+}
 /*
 bool operator>(const FCapbotMovementState_Server& a, const FCapbotMovementState_Server& b) 
 {
@@ -106,6 +133,7 @@ public:
 
 protected:
 	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
 
 public:	
 	virtual void TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) override;
@@ -114,6 +142,32 @@ public:
 	void ResetInput();
 	void SetEnabled(bool bNewEnabled);
 	void SetMovementMode(ECapbotMovementModes newMode);
+	// Back to just-spawned state, histories are emptied but keep their memory
+	void ResetMovement();
+
+	/*
+	* Resting: landed pawn without input on a still ground skips simulation and network sends
+	*/
+	UFUNCTION(BlueprintCallable, Category = "Capbot Movement|Resting")
+	bool IsResting() const { return bIsResting; }
+	UFUNCTION(BlueprintCallable, Category = "Capbot Movement|Resting")
+	void WakeUp() { SetResting(false); }
+	// Resting pawns in the world
+	static int32 GetNumRestingCapbots(const UWorld * world);
+
+	/*
+	* Movement LOD: server-controlled pawns far from every player simulate at reduced rate
+	*/
+	UFUNCTION(BlueprintCallable, Category = "Capbot Movement|LOD")
+	bool IsMovementLODReduced() const { return bLODReduced; }
+	// Simulates time skipped by reduced LOD or still on the async worker right away, keeps full rate for lodPromotionSeconds
+	void PromoteMovementLOD();
+
+	// Counters since the last call, see ARaycastGameModeBase net telemetry
+	FCapbotNetStats TakeNetStats();
+	// Bytes held by saved movement and input histories of this pawn
+	UFUNCTION(BlueprintCallable, Category = "Capbot Movement|Network")
+	int32 GetHistoryMemoryBytes() const { return (int32)(serverMovementSaved.GetAllocatedSize() + clientInputSaved.GetAllocatedSize() + compensationHistory.GetAllocatedSize()); }
 
 	/* 
 	* FLagCompensateble 
@@ -122,6 +176,26 @@ public:
 	virtual void RevertCompensation();
 	virtual bool AllowCompensation() { return true; };
 	virtual UWorld * GetCompensateableWorld() { return GetWorld(); };
+	virtual AActor * GetCompensateableActor() { return GetOwner(); }
+	virtual bool GetCompensatedCapsule(float worldTime, FVector& outCenter, float& outRadius, float& outHalfHeight) override;
+	virtual bool GetCompensatedBounds(float fromWorldTime, FBox& outBounds) override;
+
+	/*
+	* Clock synchronization. On owning client offset maps local time to server time,
+	* on server it maps server time to the owning client's time
+	*/
+	UFUNCTION(BlueprintCallable, Category = "Capbot Movement|Network")
+	float GetClockOffset() const { return clockSync.GetOffset(); }
+	UFUNCTION(BlueprintCallable, Category = "Capbot Movement|Network")
+	float GetClockJitter() const { return clockSync.GetJitter(); }
+	UFUNCTION(BlueprintCallable, Category = "Capbot Movement|Network")
+	float GetRoundTripTime() const { return clockSync.GetRoundTripTime(); }
+	// Estimated server time, as seen from this machine
+	float GetServerTime() const;
+	// Server time of the remote pawns this machine shows, half a round trip and the interpolation delay behind
+	float GetViewServerTime() const;
+	// How far in the past given (server timeline) timestamp is, for lag compensation
+	float GetCompensationSeconds(float timeStamp) const;
 
 
 	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Capbot Movement|Movement capabilities")
@@ -136,17 +210,73 @@ public:
 	
 	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Capbot Movement|Movement properties")
 	int32 maxIterations = 8;
+	// Moves longer than this are integrated in substeps (up to maxIterations), 0 disables
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Capbot Movement|Movement properties")
+	float maxSubstepDeltaTime = 1.f / 60.f;
 	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Capbot Movement|Movement properties")
 	float maxAcceptableOffset = 25.0f;
 	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Capbot Movement|Movement properties")
 	bool bNormalizeInput = true;
+	// Sweep against baked static collision when the world has one, see FCapbotStaticCollision
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Capbot Movement|Movement properties")
+	bool bUseBakedStaticCollision = true;
+	/* Server-controlled pawn is simulated on a worker thread against baked static collision only,
+	* dynamic objects are not collided with and impacts aren't reported, see FCapbotAsyncSimulation
+	*/
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Capbot Movement|Movement properties")
+	bool bAsyncSimulation = false;
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Capbot Movement|LOD")
+	bool bAllowMovementLOD = true;
+	// Beyond this from every player (or out of net cull distance) pawn is simulated at reduced rate
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Capbot Movement|LOD")
+	float lodReducedDistance = 5000.f;
+	// Pawn returns to full rate at lodReducedDistance and drops to reduced rate only this much beyond it
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Capbot Movement|LOD")
+	float lodPromotionMargin = 1000.f;
+	// Reduced pawn simulates every N-th frame with accumulated time
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Capbot Movement|LOD")
+	int32 lodReducedRate = 4;
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Capbot Movement|LOD")
+	float lodPromotionSeconds = 1.f;
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Capbot Movement|Resting")
+	bool bAllowResting = true;
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Capbot Movement|Resting")
+	float restVelocityThreshold = 1.f;
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Capbot Movement|Network")
+	float clockSyncInterval = 0.5f;
+	// How far into the past server keeps poses for lag compensation
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Capbot Movement|Network")
+	float maxCompensationSeconds = 1.f;
+	// Server keeps a client move state only this often besides the newest one, 0 keeps every move
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Capbot Movement|Network")
+	float historySampleInterval = 0.f;
+	// Min time between multicasts to remotes, 0 sends every move, going to rest is always sent
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Capbot Movement|Network")
+	float remoteUpdateInterval = 0.f;
+	// Simulated proxies are shown this far behind the newest received state, keep it above remoteUpdateInterval
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Capbot Movement|Network")
+	float remoteInterpolationDelay = 0.1f;
+	// Owning client merges consecutive near-identical inputs into one move before sending
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Capbot Movement|Network")
+	bool bCombineMoves = true;
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Capbot Movement|Network")
+	float maxCombinedMoveDeltaTime = 1.f / 30.f;
+	// Max difference of move input components still considered identical
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Capbot Movement|Network")
+	float combineMoveTolerance = 0.01f;
 
 	UFUNCTION(BlueprintCallable, Category = "Capbot Movement|Input")
 	void AddMoveInput(FVector input);
 	UFUNCTION(BlueprintCallable, Category = "Capbot Movement|Input")
 	void AddLookInput(FVector input);
 	UFUNCTION(BlueprintCallable, Category = "Capbot Movement|Input")
+	/*
+	* Jump with no event time, it starts the move. Input callbacks run when the frame polls input,
+	* not when the key went down, so their clock says nothing about where in the frame the press was
+	*/
 	void DoJumpInput();
+	// Jump pressed at given FPlatformTime::Seconds(), for input sources that timestamp their events
+	void DoJumpInputAt(double platformTime);
 	void AddInput(FCapbotMovementInput input);
 
 protected:
@@ -155,14 +285,54 @@ protected:
 	* Performs any movement. Returns true, if super method has been executed
 	*/
 	virtual bool PerformMovement(const FCapbotMovementInput& input, float deltaTime);
-	virtual void DefaultMove(const FCapbotMovementInput& input, float deltaTime);
+	// Whole move in substeps with the mode policy inlined, see CapbotMovementModes.h
+	template <typename TMode>
+	bool PerformMovementMode(const FCapbotMovementInput& input, float deltaTime);
+	template <typename TMode>
+	void MoveStep(const FCapbotMovementInput& input, float deltaTime, const FCapbotModeParams& params);
+	// Mode independent params with world gravity
+	FCapbotModeParams MakeModeParams() const;
+	// Turns timestamps of input events collected this frame into fractions of the move
+	void StampInputEvents(float DeltaTime);
+	// SafeMoveUpdatedComponent/SlideAlongSurface counterparts going through baked static collision if possible
+	void MoveCapbot(const FVector& delta, const FRotator& rotation, FHitResult& hit);
+	void SlideCapbot(const FVector& delta, float time, const FVector& normal, FHitResult& hit);
+	bool MoveWithBakedCollision(const FVector& delta, const FQuat& rotation, FHitResult& hit);
 	bool TracePrimitiveDefault(FHitResult& hit, FCapbotMovementState& fromState, float deltaTime);
 	void ApplyMovementState(const FCapbotMovementState& newState);
 
-	void TickServerOwner(float DeltaTime);
+	// Would this input (or the world around) bring resting pawn back to simulation?
+	bool ShouldWakeUp(const FCapbotMovementInput& input) const;
+	void SetResting(bool bNewResting);
+
+	// bAllowAsync false simulates the move right away, for callers that need the pose now
+	void TickServerOwner(float DeltaTime, bool bAllowAsync = true);
+	// Returns true when this frame is skipped, otherwise DeltaTime includes skipped frames
+	bool UpdateMovementLOD(float& DeltaTime);
+	void SetLODReduced(bool bNewReduced);
 	void TickServerRemote(float DeltaTime, bool bSyncTimeStamp = false);
 	void TickClientOwner(float DeltaTime);
 	void TickClientRemote(float DeltaTime);
+	bool ShouldSendRemoteUpdate(bool bWasResting);
+	// Server side, after every move
+	void SaveCompensationPose();
+	// Compensation pose and multicast after a server move
+	void FinishServerMove(bool bWasResting);
+	// Hands this tick's move to FCapbotAsyncSimulation, false if it has to be simulated right away
+	bool PublishAsyncMove(float DeltaTime);
+	void ApplyAsyncMove(const FCapbotAsyncMove& move);
+	// Drops the move in flight before a synchronous one replaces it, returns the seconds it covered
+	float CancelAsyncMove();
+	friend class FCapbotAsyncSimulation;
+	// Acks or corrects client move result against server state at the same time
+	void CheckClientMove(const FCapbotMovementState& serverState, const FCapbotMovementState& result, float timeStamp);
+	bool CanCombineMoves(const FCapbotMovementInput& pending, const FCapbotMovementInput& next) const;
+	// Pending move starts from the current state
+	void BeginPendingMove();
+	// Simulates what the pending move grew by, in the substeps the server will simulate the whole of it in
+	void SimulatePendingMove();
+	// Sends pending move to the server and saves it for replay
+	void FlushPendingMove();
 
 	virtual bool ResolvePenetrationImpl(const FVector& Adjustment, const FHitResult& Hit, const FQuat& NewRotation) override;
 
@@ -177,18 +347,70 @@ protected:
 	UPROPERTY(Transient)
 	float lastServerInputTimeStamp;
 
-	UPROPERTY(Transient)
-	TArray<FCapbotMovementState_Server> serverMovementSaved;
+	// Histories are plain quantized data in blocks of the world's FCapbotHistoryArena
+	TCapbotHistory<FCapbotCompactState> serverMovementSaved;
 	int32 maxSavedMovementSize = 128;
+	// Ground indices of serverMovementSaved
+	TSharedPtr<FCapbotGroundRegistry> groundRegistry;
 
 	UPROPERTY(Transient)
 	FCapbotMovementState_Server serverLastClientMovement;
 	UPROPERTY(Transient)
 	bool bClientMoveReceived = false;
 
-	UPROPERTY(Transient)
-	TArray<FCapbotMovementInput> clientInputSaved;
+	TCapbotHistory<FCapbotCompactInput> clientInputSaved;
 	int32 maxSavedInputSize = 128;
+	// Input history was allocated (or tried) since the pawn became locally controlled
+	bool bInputHistoryRequested = false;
+
+	FCapbotClockSync clockSync;
+	float clockSyncTimer = 0.f;
+
+	float lastRemoteUpdateTime = -1.f;
+
+	// Simulated proxy: received states oldest first and the server time shown, -1 until the first state
+	UPROPERTY(Transient)
+	TArray<FCapbotMovementState_Server> remoteStates;
+	float remoteRenderTime = -1.f;
+
+	// Published move not applied yet, serial drops moves published before a reset
+	bool bAsyncMovePending = false;
+	uint32 asyncMoveSerial = 0;
+	float asyncMoveDeltaTime = 0.f;
+
+	// Server poses by world time, see FLagCompensateable
+	TCompensationDataMemory<FCapbotCompensationPose> compensationHistory;
+	FVector preCompensationLocation;
+
+	FCapbotNetStats netStats;
+	// Newest input stamp received by the server, for missing input detection
+	float lastReceivedInputTimeStamp = -1.f;
+
+	// Simulated but not yet sent move. Start is its last full substep, a growing move goes on from there
+	FCapbotMovementInput pendingMove;
+	FCapbotMovementState pendingMoveStartState;
+	bool bPendingMoveStartResting = false;
+	float pendingMoveStartTime = 0.f;
+	FVector pendingMoveStartLook = FVector::ZeroVector;
+	// Part of the pending move simulated so far
+	float pendingMoveSimulatedTime = 0.f;
+	bool bHasPendingMove = false;
+
+	bool bLODReduced = false;
+	int32 lodPhase = 0;
+	float lodSkippedTime = 0.f;
+	float lodFullRateUntil = 0.f;
+
+	// Event time of the first timed jump press not yet consumed, 0 if none
+	double pendingJumpTime = 0.0;
+
+	bool bIsResting = false;
+	// Ground transform at the moment of falling asleep
+	FTransform restGroundTransform;
+	// World shared LOD data and resting count, from BeginPlay to EndPlay
+	TSharedPtr<FCapbotMovementLOD> movementLOD;
+	// Looked up once per move, rebakes only happen between moves
+	FCapbotStaticCollision * moveBakedCollision = nullptr;
 
 private:
 	UPROPERTY(BlueprintReadOnly, EditDefaultsOnly, Category = "Capbot Movement|Movement properties", meta = (AllowPrivateAccess = "true"))
@@ -208,5 +430,9 @@ private:
 	UFUNCTION(Client, Unreliable)
 	void ClientCorrectMove(FCapbotMovementState newState, float timeStamp);
 	UFUNCTION(NetMulticast, Unreliable)
-	void MulticastSendMoveResult(FCapbotMovementState result, FCapbotMovementInput input);
+	void MulticastSendMoveResult(FCapbotMovementState result, float timeStamp);
+	UFUNCTION(Server, WithValidation, Unreliable)
+	void ServerClockPing(float clientTime, float roundTripTime);
+	UFUNCTION(Client, Unreliable)
+	void ClientClockPong(float clientTime, float serverTime);
 };
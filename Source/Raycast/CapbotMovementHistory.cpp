@@ -0,0 +1,178 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CapbotMovementHistory.h"
+#include "CapbotMovementComponent.h"
+#include "Engine/World.h"
+
+float FCapbotGroundRegistry::recycleDelaySeconds = 10.f;
+
+namespace
+{
+	// New slots between looking for destroyed grounds
+	const int32 retireInterval = 1024;
+}
+
+uint16 FCapbotGroundRegistry::GetIndex(USceneComponent * ground)
+{
+	if (!ground)
+		return noGround;
+
+	if (const uint16 * found = indices.Find(ground))
+	{
+		if (grounds[*found].Get() == ground)
+			return *found;
+
+		// Address reused by another component, old history must not resolve to it
+		Retire(*found);
+	}
+
+	const float now = world ? world->TimeSeconds : 0.f;
+
+	uint16 index = noGround;
+	if (nextFreeIndex < freeIndices.Num() && now - freeIndices[nextFreeIndex].retireTime >= recycleDelaySeconds)
+	{
+		index = freeIndices[nextFreeIndex++].index;
+		retired[index] = false;
+		grounds[index] = ground;
+		addresses[index] = ground;
+
+		// Compact consumed head once in a while
+		if (nextFreeIndex >= 64 && nextFreeIndex * 2 >= freeIndices.Num())
+		{
+			freeIndices.RemoveAt(0, nextFreeIndex, false);
+			nextFreeIndex = 0;
+		}
+	}
+	else if (grounds.Num() < noGround)
+	{
+		index = (uint16)grounds.Add(ground);
+		addresses.Add(ground);
+		retired.Add(false);
+		if (grounds.Num() % retireInterval == 0)
+			RetireStale();
+	}
+	else
+	{
+		// Full, indices come back after the delay
+		RetireStale();
+		return noGround;
+	}
+
+	indices.Add(ground, index);
+	return index;
+}
+USceneComponent * FCapbotGroundRegistry::Find(uint16 index) const
+{
+	return grounds.IsValidIndex(index) && !retired[index] ? grounds[index].Get() : nullptr;
+}
+void FCapbotGroundRegistry::RetireStale()
+{
+	for (int32 i = 0; i < grounds.Num(); ++i)
+		if (!retired[i] && !grounds[i].IsValid())
+			Retire((uint16)i);
+}
+void FCapbotGroundRegistry::Retire(uint16 index)
+{
+	const uint16 * found = indices.Find(addresses[index]);
+	if (found && *found == index)
+		indices.Remove(addresses[index]);
+
+	grounds[index] = nullptr;
+	addresses[index] = nullptr;
+	retired[index] = true;
+
+	FFreeIndex& freeIndex = freeIndices[freeIndices.AddUninitialized()];
+	freeIndex.index = index;
+	freeIndex.retireTime = world ? world->TimeSeconds : 0.f;
+}
+
+bool CapbotInterpolation::InterpolateMotion(const FVector& locationA, const FVector& velocityA, const FVector& locationB, const FVector& velocityB,
+	float alpha, float deltaSeconds, FVector& outLocation, FVector& outVelocity)
+{
+	// Velocities can't explain the distance, tangents would only overshoot
+	const float maxDistance = FMath::Max(velocityA.Size(), velocityB.Size()) * deltaSeconds * 2.f + 1.f;
+	if (deltaSeconds <= 0.f || FVector::DistSquared(locationA, locationB) > FMath::Square(maxDistance))
+	{
+		outLocation = FMath::Lerp(locationA, locationB, alpha);
+		outVelocity = FMath::Lerp(velocityA, velocityB, alpha);
+		return false;
+	}
+
+	// Tangents are per unit of alpha
+	const FVector tangentA = velocityA * deltaSeconds;
+	const FVector tangentB = velocityB * deltaSeconds;
+	outLocation = FMath::CubicInterp(locationA, tangentA, locationB, tangentB, alpha);
+	outVelocity = FMath::CubicInterpDerivative(locationA, tangentA, locationB, tangentB, alpha) / deltaSeconds;
+	return true;
+}
+
+FCapbotCompensationPose InterpolateCompensationData(const FCapbotCompensationPose& a, const FCapbotCompensationPose& b, float alpha, float deltaSeconds)
+{
+	FCapbotCompensationPose pose;
+	CapbotInterpolation::InterpolateMotion(a.location, a.velocity, b.location, b.velocity, alpha, deltaSeconds, pose.location, pose.velocity);
+	return pose;
+}
+
+FCapbotCompactState FCapbotCompactState::Make(const FCapbotMovementState& state, float timeStamp, FCapbotGroundRegistry& grounds)
+{
+	FCapbotCompactState compact;
+	compact.location = state.location;
+	compact.timeStamp = timeStamp;
+	for (int32 i = 0; i < 3; ++i)
+		compact.velocity[i] = state.velocity[i];
+	compact.rotation[0] = FRotator::CompressAxisToShort(state.rotation.Pitch);
+	compact.rotation[1] = FRotator::CompressAxisToShort(state.rotation.Yaw);
+	compact.rotation[2] = FRotator::CompressAxisToShort(state.rotation.Roll);
+	compact.ground = grounds.GetIndex(state.ground);
+	compact.mode = (uint8)state.mode.GetValue();
+	compact.bIsLanded = state.bIsLanded ? 1 : 0;
+
+	return compact;
+}
+FCapbotMovementState_Server FCapbotCompactState::Expand(const FCapbotGroundRegistry& grounds) const
+{
+	FCapbotMovementState state;
+	state.location = location;
+	state.velocity = FVector(velocity[0], velocity[1], velocity[2]);
+	state.rotation = FRotator(
+		FRotator::DecompressAxisFromShort(rotation[0]),
+		FRotator::DecompressAxisFromShort(rotation[1]),
+		FRotator::DecompressAxisFromShort(rotation[2]));
+	state.ground = grounds.Find(ground);
+	state.mode = (ECapbotMovementModes)mode;
+	state.bIsLanded = bIsLanded != 0;
+
+	return FCapbotMovementState_Server::Make(state, timeStamp);
+}
+
+FCapbotCompactInput FCapbotCompactInput::Make(const FCapbotMovementInput& input)
+{
+	FCapbotCompactInput compact;
+	compact.timeStamp = input.timeStamp;
+	compact.deltaTime = input.deltaTime;
+	for (int32 i = 0; i < 3; ++i)
+	{
+		compact.moveInput[i] = input.moveInput[i];
+		compact.lookInput[i] = input.lookInput[i];
+	}
+	compact.flags = input.flags;
+	compact.jumpFraction = input.jumpFraction;
+
+	return compact;
+}
+FCapbotMovementInput FCapbotCompactInput::Expand() const
+{
+	FCapbotMovementInput input;
+	input.timeStamp = timeStamp;
+	input.deltaTime = deltaTime;
+	input.moveInput = FVector(moveInput[0], moveInput[1], moveInput[2]);
+	input.lookInput = FVector(lookInput[0], lookInput[1], lookInput[2]);
+	input.flags = flags;
+	input.jumpFraction = jumpFraction;
+
+	return input;
+}
+void FCapbotCompactInput::Quantize(FCapbotMovementInput& input)
+{
+	input = Make(input).Expand();
+}
@@ -0,0 +1,108 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Math/Float16.h"
+#include "CapbotWorldRegistry.h"
+
+class UWorld;
+class USceneComponent;
+struct FCapbotMovementState;
+struct FCapbotMovementState_Server;
+struct FCapbotMovementInput;
+
+/** Per-world small indices for ground components so saved history holds
+ * no object pointers the garbage collector would have to look at.
+ * Indices of destroyed grounds are reused only after recycleDelaySeconds, when no history refers to them anymore
+ */
+class RAYCAST_API FCapbotGroundRegistry : public TCapbotWorldRegistry<FCapbotGroundRegistry>
+{
+public:
+	static const uint16 noGround = MAX_uint16;
+	// Longer than any history holding ground indices
+	static float recycleDelaySeconds;
+
+	FCapbotGroundRegistry(const UWorld * inWorld) : world(inWorld) {}
+
+	// Game thread only
+	uint16 GetIndex(USceneComponent * ground);
+	USceneComponent * Find(uint16 index) const;
+
+	int32 Num() const { return grounds.Num() - freeIndices.Num(); }
+
+private:
+	// Frees indices of destroyed grounds
+	void RetireStale();
+	void Retire(uint16 index);
+
+	struct FFreeIndex
+	{
+		uint16 index;
+		float retireTime;
+	};
+
+	const UWorld * world;
+	TArray<TWeakObjectPtr<USceneComponent>> grounds;
+	// Address each slot was added with, key in indices
+	TArray<USceneComponent*> addresses;
+	TMap<USceneComponent*, uint16> indices;
+	// Oldest first
+	TArray<FFreeIndex> freeIndices;
+	int32 nextFreeIndex = 0;
+	// Slot is in freeIndices
+	TBitArray<> retired;
+};
+
+namespace CapbotInterpolation
+{
+	/* Cubic Hermite between two points using their velocities as tangents
+	* Returns false and interpolates linearly when velocities can't explain the distance (teleport, reset)
+	*/
+	RAYCAST_API bool InterpolateMotion(const FVector& locationA, const FVector& velocityA, const FVector& locationB, const FVector& velocityB,
+		float alpha, float deltaSeconds, FVector& outLocation, FVector& outVelocity);
+}
+
+/** Server pose kept for lag compensation, 24 bytes
+ */
+struct RAYCAST_API FCapbotCompensationPose
+{
+	FVector location = FVector::ZeroVector;
+	FVector velocity = FVector::ZeroVector;
+};
+// TCompensationDataMemory<FCapbotCompensationPose> interpolation
+RAYCAST_API FCapbotCompensationPose InterpolateCompensationData(const FCapbotCompensationPose& a, const FCapbotCompensationPose& b, float alpha, float deltaSeconds);
+
+/** Quantized FCapbotMovementState_Server for server side history, 32 bytes
+ */
+struct RAYCAST_API FCapbotCompactState
+{
+	FVector location;
+	float timeStamp;
+	FFloat16 velocity[3];
+	uint16 rotation[3];
+	uint16 ground;
+	uint8 mode;
+	uint8 bIsLanded;
+
+	static FCapbotCompactState Make(const FCapbotMovementState& state, float timeStamp, FCapbotGroundRegistry& grounds);
+	FCapbotMovementState_Server Expand(const FCapbotGroundRegistry& grounds) const;
+};
+
+/** Quantized FCapbotMovementInput for client side replay history, 24 bytes
+ * Inputs are passed through Quantize before use so replay matches the original move exactly
+ */
+struct RAYCAST_API FCapbotCompactInput
+{
+	float timeStamp;
+	float deltaTime;
+	FFloat16 moveInput[3];
+	FFloat16 lookInput[3];
+	uint8 flags;
+	uint8 jumpFraction;
+
+	static FCapbotCompactInput Make(const FCapbotMovementInput& input);
+	FCapbotMovementInput Expand() const;
+
+	static void Quantize(FCapbotMovementInput& input);
+};
@@ -0,0 +1,38 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CapbotMovementLOD.h"
+#include "Engine/World.h"
+#include "GameFramework/PlayerController.h"
+#include "GameFramework/Pawn.h"
+
+const TArray<FVector>& FCapbotMovementLOD::GetViewerLocations()
+{
+	if (frame == GFrameCounter)
+		return viewerLocations;
+
+	frame = GFrameCounter;
+	viewerLocations.Reset();
+
+	for (FConstPlayerControllerIterator it = world->GetPlayerControllerIterator(); it; ++it)
+	{
+		APlayerController * controller = it->Get();
+		if (!controller)
+			continue;
+
+		// Bots are controlled by AIControllers, only real players see anything
+		if (AActor * viewTarget = controller->GetViewTarget())
+			viewerLocations.Add(viewTarget->GetActorLocation());
+		else if (APawn * pawn = controller->GetPawn())
+			viewerLocations.Add(pawn->GetActorLocation());
+	}
+
+	return viewerLocations;
+}
+float FCapbotMovementLOD::GetClosestViewerDistanceSquared(const FVector& location)
+{
+	float closest = BIG_NUMBER;
+	for (const FVector& viewer : GetViewerLocations())
+		closest = FMath::Min(closest, FVector::DistSquared(viewer, location));
+
+	return closest;
+}
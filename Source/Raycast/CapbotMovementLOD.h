@@ -0,0 +1,35 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "CapbotWorldRegistry.h"
+
+class UWorld;
+
+/** Per-world shared data for server movement: viewers for level of detail, LOD phases and resting count
+ * Viewer locations are gathered once per frame, pawns pick the closest.
+ * Components keep the pointer from Get, game thread only
+ */
+class RAYCAST_API FCapbotMovementLOD : public TCapbotWorldRegistry<FCapbotMovementLOD>
+{
+public:
+	FCapbotMovementLOD(UWorld * inWorld) : world(inWorld) {}
+
+	// Locations of every player's view target, refreshed on first call in a frame
+	const TArray<FVector>& GetViewerLocations();
+	// Squared distance to the closest viewer, BIG_NUMBER if there are none
+	float GetClosestViewerDistanceSquared(const FVector& location);
+	// Round robin phase so reduced pawns are spread over frames evenly
+	int32 AssignPhase() { return nextPhase++; }
+
+	void AddResting(int32 amount) { numResting += amount; }
+	int32 GetNumResting() const { return numResting; }
+
+private:
+	UWorld * world;
+	uint64 frame = 0;
+	TArray<FVector> viewerLocations;
+	int32 nextPhase = 0;
+	int32 numResting = 0;
+};
@@ -0,0 +1,159 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "CapbotMovementComponent.h"
+
+/** Movement mode policies, resolved at compile time by UCapbotMovementComponent::PerformMovementMode
+ * A policy tells whether the mode needs gravity, sweeps and resting, and integrates velocity.
+ * Everything else of a step is shared and inlined per mode, so a mode costs nothing to pawns in other modes
+ */
+
+// Values read once per move instead of per step
+struct FCapbotModeParams
+{
+	float acceleration;
+	float deceleration;
+	float maxMovementSpeed;
+	float jumpVelocity;
+	float gravityZ;
+};
+
+namespace CapbotMovementModes
+{
+	FORCEINLINE void Decelerate(FVector& velocity, float amount)
+	{
+		if (velocity.SizeSquared() < amount * amount)
+			velocity = FVector::ZeroVector;
+		else
+			velocity -= velocity.GetUnsafeNormal() * amount;
+	}
+
+	/* Splits a move into substeps of at most maxSubstepDeltaTime (and at least deltaTime / maxIterations),
+	* a jump press starts its own substep, at the latest the last one, and look input is spread over them.
+	* Calls func(stepInput, stepTime) until it returns false
+	*/
+	template <typename Func>
+	FORCEINLINE void ForEachSubstep(const FCapbotMovementInput& input, float deltaTime, int32 maxIterations, float maxSubstepDeltaTime, const Func& func)
+	{
+		const bool bJump = (input.flags & ECapbotMovementInputFlags::CMI_Jump) > 0;
+		const float jumpTime = bJump ? deltaTime * input.jumpFraction / 255.f : -1.f;
+
+		const float minStep = deltaTime / FMath::Max(1, maxIterations);
+		const float maxStep = maxSubstepDeltaTime > 0.f ? FMath::Max(maxSubstepDeltaTime, minStep) : deltaTime;
+
+		FCapbotMovementInput step = input;
+
+		bool bJumped = false;
+		float time = 0.f;
+		do
+		{
+			float stepTime = FMath::Min(maxStep, deltaTime - time);
+			// Split at the jump press so it starts where it happened
+			if (bJump && !bJumped && jumpTime > time)
+				stepTime = FMath::Min(stepTime, FMath::Max(jumpTime - time, KINDA_SMALL_NUMBER));
+
+			// Press at the very end of the move (usual for presses stamped right before the tick) goes to the last step
+			const bool bLastStep = deltaTime - (time + stepTime) <= KINDA_SMALL_NUMBER;
+
+			step.flags = input.flags & ~ECapbotMovementInputFlags::CMI_Jump;
+			if (bJump && !bJumped && (jumpTime <= time + KINDA_SMALL_NUMBER || bLastStep))
+			{
+				step.flags |= ECapbotMovementInputFlags::CMI_Jump;
+				bJumped = true;
+			}
+			// Look input is a total over the move
+			step.lookInput = deltaTime > 0.f ? input.lookInput * (stepTime / deltaTime) : input.lookInput;
+
+			if (!func(step, stepTime))
+				return;
+
+			time += stepTime;
+		} while (deltaTime - time > KINDA_SMALL_NUMBER);
+	}
+}
+
+// On the ground: input acceleration, braking and jumps
+struct FCapbotWalkingMode
+{
+	static const bool bGravity = true;
+	static const bool bSweep = true;
+	static const bool bCanRest = true;
+
+	static FORCEINLINE void Accelerate(FCapbotMovementState& state, const FCapbotMovementInput& input, const FCapbotModeParams& params, float deltaTime)
+	{
+		if (!input.moveInput.IsNearlyZero())
+			state.velocity += input.moveInput * params.acceleration * deltaTime;
+		else
+			CapbotMovementModes::Decelerate(state.velocity, params.deceleration * deltaTime);
+
+		state.velocity.Z += params.gravityZ * deltaTime;
+
+		if ((input.flags & ECapbotMovementInputFlags::CMI_Jump) > 0)
+			state.velocity.Z += params.jumpVelocity;
+	}
+};
+
+// In the air: input acceleration only
+struct FCapbotFallingMode
+{
+	static const bool bGravity = true;
+	static const bool bSweep = true;
+	static const bool bCanRest = true;
+
+	static FORCEINLINE void Accelerate(FCapbotMovementState& state, const FCapbotMovementInput& input, const FCapbotModeParams& params, float deltaTime)
+	{
+		if (!input.moveInput.IsNearlyZero())
+			state.velocity += input.moveInput * params.acceleration * deltaTime;
+
+		state.velocity.Z += params.gravityZ * deltaTime;
+	}
+};
+
+// CMM_Default, walking or falling depending on the landed state of the previous step
+struct FCapbotDefaultMode
+{
+	static const bool bGravity = true;
+	static const bool bSweep = true;
+	static const bool bCanRest = true;
+
+	static FORCEINLINE void Accelerate(FCapbotMovementState& state, const FCapbotMovementInput& input, const FCapbotModeParams& params, float deltaTime)
+	{
+		if (state.bIsLanded)
+			FCapbotWalkingMode::Accelerate(state, input, params, deltaTime);
+		else
+			FCapbotFallingMode::Accelerate(state, input, params, deltaTime);
+	}
+};
+
+// CMM_Flying, free 3D movement with collision and no gravity
+struct FCapbotFlyingMode
+{
+	static const bool bGravity = false;
+	static const bool bSweep = true;
+	static const bool bCanRest = false;
+
+	static FORCEINLINE void Accelerate(FCapbotMovementState& state, const FCapbotMovementInput& input, const FCapbotModeParams& params, float deltaTime)
+	{
+		if (!input.moveInput.IsNearlyZero())
+			state.velocity += input.moveInput * params.acceleration * deltaTime;
+		else
+			CapbotMovementModes::Decelerate(state.velocity, params.deceleration * deltaTime);
+
+		state.velocity = state.velocity.GetClampedToMaxSize(params.maxMovementSpeed);
+	}
+};
+
+// CMM_Spectator, goes through everything at input speed
+struct FCapbotSpectatorMode
+{
+	static const bool bGravity = false;
+	static const bool bSweep = false;
+	static const bool bCanRest = false;
+
+	static FORCEINLINE void Accelerate(FCapbotMovementState& state, const FCapbotMovementInput& input, const FCapbotModeParams& params, float deltaTime)
+	{
+		state.velocity = input.moveInput * params.maxMovementSpeed;
+	}
+};
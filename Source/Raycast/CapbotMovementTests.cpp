@@ -0,0 +1,176 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+#include "CapbotMovementComponent.h"
+#include "CapbotMovementModes.h"
+#include "CapbotMovementHistory.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FCapbotSubstepJumpTest, "Raycast.Capbot.SubstepJump",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FCapbotSubstepJumpTest::RunTest(const FString& Parameters)
+{
+	const float deltaTimes[] = { 1.f / 30.f, 1.f / 60.f, 1.f / 144.f };
+	const float maxSubstepDeltaTime = 1.f / 120.f;
+
+	for (const float deltaTime : deltaTimes)
+		for (int32 fraction = 0; fraction <= 255; ++fraction)
+		{
+			FCapbotMovementInput input;
+			input.flags = ECapbotMovementInputFlags::CMI_Jump;
+			input.moveInput = FVector::ZeroVector;
+			input.lookInput = FVector(0.f, 0.f, 1.f);
+			input.deltaTime = deltaTime;
+			input.jumpFraction = (uint8)fraction;
+
+			int32 jumps = 0;
+			float jumpStart = -1.f;
+			float time = 0.f;
+			FVector look = FVector::ZeroVector;
+			CapbotMovementModes::ForEachSubstep(input, deltaTime, 4, maxSubstepDeltaTime, [&](const FCapbotMovementInput& step, float stepTime)
+			{
+				if ((step.flags & ECapbotMovementInputFlags::CMI_Jump) > 0)
+				{
+					++jumps;
+					jumpStart = time;
+				}
+				look += step.lookInput;
+				time += stepTime;
+				return true;
+			});
+
+			const FString context = FString::Printf(TEXT("dt %.4f, jumpFraction %d"), deltaTime, fraction);
+			TestEqual(*(TEXT("One jump step, ") + context), jumps, 1);
+			TestTrue(*(TEXT("Whole move simulated, ") + context), FMath::IsNearlyEqual(time, deltaTime, KINDA_SMALL_NUMBER));
+			TestTrue(*(TEXT("Look input kept, ") + context), look.Equals(input.lookInput, KINDA_SMALL_NUMBER));
+			// Step with the jump starts at the press, or up to one substep earlier for presses at the end of the move
+			const float jumpTime = deltaTime * fraction / 255.f;
+			TestTrue(*(TEXT("Jump not after the press, ") + context), jumpStart >= 0.f && jumpStart <= jumpTime + KINDA_SMALL_NUMBER);
+			TestTrue(*(TEXT("Jump at most a substep before the press, ") + context), jumpTime - jumpStart <= maxSubstepDeltaTime + KINDA_SMALL_NUMBER);
+		}
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FCapbotHermiteHistoryTest, "Raycast.Capbot.HermiteHistory",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FCapbotHermiteHistoryTest::RunTest(const FString& Parameters)
+{
+	// Sparse history against the dense one it replaces, on a jump arc and a circle
+	const float sparseInterval = 0.1f;
+	const float denseInterval = 1.f / 120.f;
+	const float duration = 2.f;
+	const float maxHermiteError = 0.1f;
+
+	struct FTrajectory
+	{
+		const TCHAR * name;
+		TFunction<void(float, FVector&, FVector&)> sample;
+	};
+	const FTrajectory trajectories[] =
+	{
+		{ TEXT("Arc"), [](float t, FVector& location, FVector& velocity)
+		{
+			const FVector start(0.f, 0.f, 100.f);
+			const FVector startVelocity(600.f, 200.f, 420.f);
+			const FVector gravity(0.f, 0.f, -980.f);
+			location = start + startVelocity * t + gravity * (0.5f * t * t);
+			velocity = startVelocity + gravity * t;
+		} },
+		{ TEXT("Circle"), [](float t, FVector& location, FVector& velocity)
+		{
+			const float radius = 300.f;
+			const float angularSpeed = 2.f;
+			location = FVector(FMath::Cos(angularSpeed * t), FMath::Sin(angularSpeed * t), 0.f) * radius;
+			velocity = FVector(-FMath::Sin(angularSpeed * t), FMath::Cos(angularSpeed * t), 0.f) * radius * angularSpeed;
+		} },
+	};
+
+	for (const FTrajectory& trajectory : trajectories)
+	{
+		float hermiteError = 0.f;
+		float linearError = 0.f;
+
+		for (float sparseTime = 0.f; sparseTime + sparseInterval <= duration; sparseTime += sparseInterval)
+		{
+			FVector locationA, velocityA, locationB, velocityB;
+			trajectory.sample(sparseTime, locationA, velocityA);
+			trajectory.sample(sparseTime + sparseInterval, locationB, velocityB);
+
+			for (float denseTime = 0.f; denseTime < sparseInterval; denseTime += denseInterval)
+			{
+				const float alpha = denseTime / sparseInterval;
+				FVector expectedLocation, expectedVelocity;
+				trajectory.sample(sparseTime + denseTime, expectedLocation, expectedVelocity);
+
+				FVector location, velocity;
+				const bool bHermite = CapbotInterpolation::InterpolateMotion(locationA, velocityA, locationB, velocityB, alpha, sparseInterval, location, velocity);
+				TestTrue(*FString::Printf(TEXT("%s uses Hermite at %.3f"), trajectory.name, sparseTime + denseTime), bHermite);
+
+				hermiteError = FMath::Max(hermiteError, FVector::Dist(location, expectedLocation));
+				linearError = FMath::Max(linearError, FVector::Dist(FMath::Lerp(locationA, locationB, alpha), expectedLocation));
+			}
+		}
+
+		AddInfo(FString::Printf(TEXT("%s: Hermite error %.4f, linear error %.4f"), trajectory.name, hermiteError, linearError));
+		TestTrue(*FString::Printf(TEXT("%s Hermite error below linear"), trajectory.name), hermiteError < linearError);
+		TestTrue(*FString::Printf(TEXT("%s Hermite error below %.2f"), trajectory.name, maxHermiteError), hermiteError < maxHermiteError);
+	}
+
+	// Same trajectories through the quantized server history, decimated like TickServerRemote saves it
+	TSharedPtr<FCapbotHistoryArena> arena = MakeShareable(new FCapbotHistoryArena(nullptr));
+	FCapbotGroundRegistry grounds(nullptr);
+	const int32 denseSteps = FMath::RoundToInt(duration / denseInterval);
+
+	for (const FTrajectory& trajectory : trajectories)
+	{
+		TCapbotHistory<FCapbotCompactState> history;
+		if (!TestTrue(TEXT("History allocates"), history.Allocate(arena, 128)))
+			return false;
+
+		for (int32 step = 0; step <= denseSteps; ++step)
+		{
+			FCapbotMovementState state;
+			state.ground = nullptr;
+			state.rotation = FRotator::ZeroRotator;
+			state.mode = ECapbotMovementModes::CMM_Default;
+			state.bIsLanded = false;
+			trajectory.sample(step * denseInterval, state.location, state.velocity);
+
+			const FCapbotCompactState saved = FCapbotCompactState::Make(state, step * denseInterval, grounds);
+			const int32 savedNum = history.Num();
+			if (savedNum >= 2 && saved.timeStamp - history[savedNum - 2].timeStamp < sparseInterval)
+				history.Last() = saved;
+			else
+				TestTrue(TEXT("History has room"), history.Add(saved));
+		}
+
+		const int32 maxSaved = FMath::CeilToInt(duration / sparseInterval) + 2;
+		TestTrue(*FString::Printf(TEXT("%s history decimated to %d states"), trajectory.name, history.Num()), history.Num() <= maxSaved);
+
+		float compactError = 0.f;
+		int32 index = 0;
+		for (int32 step = 0; step <= denseSteps; ++step)
+		{
+			const float time = step * denseInterval;
+			while (index + 2 < history.Num() && history[index + 1].timeStamp <= time)
+				++index;
+
+			FVector expectedLocation, expectedVelocity;
+			trajectory.sample(time, expectedLocation, expectedVelocity);
+			const FCapbotMovementState state = FCapbotMovementState_Server::Interpolate(history[index].Expand(grounds), history[index + 1].Expand(grounds), time);
+			compactError = FMath::Max(compactError, FVector::Dist(state.location, expectedLocation));
+		}
+
+		AddInfo(FString::Printf(TEXT("%s: compact history error %.4f over %d states"), trajectory.name, compactError, history.Num()));
+		TestTrue(*FString::Printf(TEXT("%s compact history error below %.2f"), trajectory.name, maxHermiteError), compactError < maxHermiteError);
+	}
+
+	return true;
+}
+
+#endif
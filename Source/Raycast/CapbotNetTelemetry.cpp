@@ -0,0 +1,142 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CapbotNetTelemetry.h"
+#include "CapbotMovementComponent.h"
+#include "HAL/PlatformFilemanager.h"
+#include "HAL/FileManager.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#if PLATFORM_WINDOWS
+#include "Windows/WindowsHWrapper.h"
+#else
+#include <stdio.h>
+#endif
+
+namespace
+{
+	// IFileManager::Move deletes the destination first, readers could see no file at all
+	bool ReplaceFile(const FString& to, const FString& from)
+	{
+		const FString fullTo = FPaths::ConvertRelativePathToFull(to);
+		const FString fullFrom = FPaths::ConvertRelativePathToFull(from);
+#if PLATFORM_WINDOWS
+		return ::MoveFileExW(*fullFrom, *fullTo, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+		// rename() replaces the destination atomically
+		return ::rename(TCHAR_TO_UTF8(*fullFrom), TCHAR_TO_UTF8(*fullTo)) == 0;
+#endif
+	}
+}
+
+FCapbotNetTelemetry::FCapbotNetTelemetry(const FString& inPath, bool bInPrometheus, int64 inMaxFileBytes, int32 inFilesKept)
+	: path(inPath), bPrometheus(bInPrometheus), maxFileBytes(inMaxFileBytes), filesKept(FMath::Max(0, inFilesKept))
+{
+	IFileManager::Get().MakeDirectory(*FPaths::GetPath(path), true);
+}
+FCapbotNetTelemetry::~FCapbotNetTelemetry()
+{
+	delete file;
+}
+
+void FCapbotNetTelemetry::Write(float time, float sampleSeconds, const TArray<FCapbotNetTelemetryRow>& rows)
+{
+	if (sampleSeconds <= 0.f)
+		return;
+
+	buffer.Reset();
+	if (bPrometheus)
+		WritePrometheus(time, sampleSeconds, rows);
+	else
+		WriteCSV(time, sampleSeconds, rows);
+}
+
+bool FCapbotNetTelemetry::OpenCSV()
+{
+	IPlatformFile& platformFile = FPlatformFileManager::Get().GetPlatformFile();
+	const bool bNew = !platformFile.FileExists(*path);
+	file = platformFile.OpenWrite(*path, true /*append*/);
+	if (!file)
+	{
+		UE_LOG(CapbotMovementComponentLog, Warning, TEXT("Can't open net telemetry file %s"), *path);
+		return false;
+	}
+	fileBytes = file->Size();
+
+	if (bNew || fileBytes == 0)
+	{
+		const FTCHARToUTF8 header(TEXT("time,seconds,player,address,pawn,rtt,clock_offset,clock_jitter,inputs_per_second,missing_inputs,acked_moves,corrected_moves,corrected_ratio,mean_correction_offset,replayed_moves,rpc_bytes_in_per_second,rpc_bytes_out_per_second\n"));
+		file->Write((const uint8*)header.Get(), header.Length());
+		fileBytes += header.Length();
+	}
+	return true;
+}
+void FCapbotNetTelemetry::RotateCSV()
+{
+	delete file;
+	file = nullptr;
+
+	// path.N is older than path.N-1
+	IFileManager& fileManager = IFileManager::Get();
+	if (filesKept == 0)
+	{
+		fileManager.Delete(*path);
+		return;
+	}
+	fileManager.Delete(*FString::Printf(TEXT("%s.%d"), *path, filesKept));
+	for (int32 i = filesKept - 1; i >= 1; --i)
+		fileManager.Move(*FString::Printf(TEXT("%s.%d"), *path, i + 1), *FString::Printf(TEXT("%s.%d"), *path, i), true, true);
+	fileManager.Move(*FString::Printf(TEXT("%s.1"), *path), *path, true, true);
+}
+void FCapbotNetTelemetry::WriteCSV(float time, float sampleSeconds, const TArray<FCapbotNetTelemetryRow>& rows)
+{
+	if (rows.Num() == 0)
+		return;
+	if (!file && !OpenCSV())
+		return;
+
+	for (const FCapbotNetTelemetryRow& row : rows)
+	{
+		const FCapbotNetStats& stats = row.stats;
+		buffer += FString::Printf(TEXT("%.3f,%.3f,%d,%s,%s,%.4f,%.4f,%.4f,%.2f,%d,%d,%d,%.4f,%.3f,%d,%.1f,%.1f\n"),
+			time, sampleSeconds, row.playerId, *row.address, *row.pawn,
+			row.roundTripTime, row.clockOffset, row.clockJitter,
+			stats.inputsReceived / sampleSeconds, stats.missingInputs,
+			stats.ackedMoves, stats.correctedMoves, stats.GetCorrectedRatio(), stats.GetMeanCorrectionOffset(),
+			stats.replayedMoves, stats.rpcBytesIn / sampleSeconds, stats.rpcBytesOut / sampleSeconds);
+	}
+
+	const FTCHARToUTF8 utf8(*buffer);
+	file->Write((const uint8*)utf8.Get(), utf8.Length());
+	fileBytes += utf8.Length();
+
+	if (fileBytes >= maxFileBytes)
+		RotateCSV();
+}
+void FCapbotNetTelemetry::WritePrometheus(float time, float sampleSeconds, const TArray<FCapbotNetTelemetryRow>& rows)
+{
+	buffer += FString::Printf(TEXT("# HELP capbot_sample_seconds Length of the last sample\n# TYPE capbot_sample_seconds gauge\ncapbot_sample_seconds %.3f\n"), sampleSeconds);
+
+	auto writeGauge = [&](const TCHAR * name, const TCHAR * help, TFunctionRef<float(const FCapbotNetTelemetryRow&)> value)
+	{
+		buffer += FString::Printf(TEXT("# HELP %s %s\n# TYPE %s gauge\n"), name, help, name);
+		for (const FCapbotNetTelemetryRow& row : rows)
+			buffer += FString::Printf(TEXT("%s{player=\"%d\",address=\"%s\",pawn=\"%s\"} %g\n"), name, row.playerId, *row.address, *row.pawn, value(row));
+	};
+	writeGauge(TEXT("capbot_rtt_seconds"), TEXT("Filtered round trip time"), [](const FCapbotNetTelemetryRow& row) { return row.roundTripTime; });
+	writeGauge(TEXT("capbot_clock_offset_seconds"), TEXT("Estimated client clock offset"), [](const FCapbotNetTelemetryRow& row) { return row.clockOffset; });
+	writeGauge(TEXT("capbot_clock_jitter_seconds"), TEXT("Clock offset jitter"), [](const FCapbotNetTelemetryRow& row) { return row.clockJitter; });
+	writeGauge(TEXT("capbot_inputs_per_second"), TEXT("Inputs received per second"), [sampleSeconds](const FCapbotNetTelemetryRow& row) { return row.stats.inputsReceived / sampleSeconds; });
+	writeGauge(TEXT("capbot_missing_inputs"), TEXT("Inputs lost in the last sample"), [](const FCapbotNetTelemetryRow& row) { return (float)row.stats.missingInputs; });
+	writeGauge(TEXT("capbot_acked_moves"), TEXT("Moves acknowledged in the last sample"), [](const FCapbotNetTelemetryRow& row) { return (float)row.stats.ackedMoves; });
+	writeGauge(TEXT("capbot_corrected_moves"), TEXT("Moves corrected in the last sample"), [](const FCapbotNetTelemetryRow& row) { return (float)row.stats.correctedMoves; });
+	writeGauge(TEXT("capbot_corrected_ratio"), TEXT("Corrected of all checked moves in the last sample"), [](const FCapbotNetTelemetryRow& row) { return row.stats.GetCorrectedRatio(); });
+	writeGauge(TEXT("capbot_mean_correction_offset"), TEXT("Mean offset of corrected moves in world units"), [](const FCapbotNetTelemetryRow& row) { return row.stats.GetMeanCorrectionOffset(); });
+	writeGauge(TEXT("capbot_replayed_moves"), TEXT("Moves replayed after corrections in the last sample"), [](const FCapbotNetTelemetryRow& row) { return (float)row.stats.replayedMoves; });
+	writeGauge(TEXT("capbot_rpc_bytes_in_per_second"), TEXT("Estimated movement RPC payload received per second"), [sampleSeconds](const FCapbotNetTelemetryRow& row) { return row.stats.rpcBytesIn / sampleSeconds; });
+	writeGauge(TEXT("capbot_rpc_bytes_out_per_second"), TEXT("Estimated movement RPC payload sent per second"), [sampleSeconds](const FCapbotNetTelemetryRow& row) { return row.stats.rpcBytesOut / sampleSeconds; });
+
+	// Collector must never see a half written or missing file
+	const FString tempPath = path + TEXT(".tmp");
+	if (FFileHelper::SaveStringToFile(buffer, *tempPath, FFileHelper::EEncodingOptions::ForceUTF8WithoutBOM) && !ReplaceFile(path, tempPath))
+		UE_LOG(CapbotMovementComponentLog, Warning, TEXT("Could not replace %s"), *path);
+}
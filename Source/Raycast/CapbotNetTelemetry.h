@@ -0,0 +1,69 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class IFileHandle;
+
+/** Movement netcode counters of one pawn, collected since the last TakeNetStats
+ * RPC bytes are estimated property payloads, packet and bunch headers are not counted
+ */
+struct RAYCAST_API FCapbotNetStats
+{
+	int32 inputsReceived = 0;
+	// Gaps in received input timeline, in moves of the size of the input after the gap
+	int32 missingInputs = 0;
+	int32 ackedMoves = 0;
+	int32 correctedMoves = 0;
+	float correctionOffsetSum = 0.f;
+	// Moves re-simulated after corrections, estimated from history on the server
+	int32 replayedMoves = 0;
+	int32 rpcBytesIn = 0;
+	int32 rpcBytesOut = 0;
+
+	float GetMeanCorrectionOffset() const { return correctedMoves > 0 ? correctionOffsetSum / correctedMoves : 0.f; }
+	float GetCorrectedRatio() const { return ackedMoves + correctedMoves > 0 ? (float)correctedMoves / (ackedMoves + correctedMoves) : 0.f; }
+};
+
+// One pawn in one telemetry sample
+struct RAYCAST_API FCapbotNetTelemetryRow
+{
+	int32 playerId = -1;
+	FString address;
+	FString pawn;
+	float roundTripTime = 0.f;
+	float clockOffset = 0.f;
+	float clockJitter = 0.f;
+	FCapbotNetStats stats;
+};
+
+/** Writes netcode time series to a local file for headless servers
+ * CSV appends a row per pawn per sample and rotates the file at maxFileBytes keeping filesKept old ones,
+ * Prometheus replaces the file with the latest sample, for a textfile collector
+ */
+class RAYCAST_API FCapbotNetTelemetry
+{
+public:
+	FCapbotNetTelemetry(const FString& inPath, bool bInPrometheus, int64 inMaxFileBytes, int32 inFilesKept);
+	~FCapbotNetTelemetry();
+
+	// Rows cover sampleSeconds ending at time
+	void Write(float time, float sampleSeconds, const TArray<FCapbotNetTelemetryRow>& rows);
+
+private:
+	void WriteCSV(float time, float sampleSeconds, const TArray<FCapbotNetTelemetryRow>& rows);
+	void WritePrometheus(float time, float sampleSeconds, const TArray<FCapbotNetTelemetryRow>& rows);
+	bool OpenCSV();
+	void RotateCSV();
+
+	FString path;
+	bool bPrometheus;
+	int64 maxFileBytes;
+	int32 filesKept;
+
+	IFileHandle * file = nullptr;
+	int64 fileBytes = 0;
+	// Reused between samples
+	FString buffer;
+};
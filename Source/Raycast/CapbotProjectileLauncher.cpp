@@ -0,0 +1,55 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CapbotProjectileLauncher.h"
+#include "CapbotProjectiles.h"
+#include "CapbotMovementComponent.h"
+#include "Capbot.h"
+#include "Engine/World.h"
+
+UCapbotProjectileLauncher::UCapbotProjectileLauncher()
+{
+	SetIsReplicated(true);
+}
+
+void UCapbotProjectileLauncher::Fire(FVector origin, FVector direction)
+{
+	direction = direction.GetSafeNormal();
+	if (direction.IsZero())
+		return;
+
+	if (GetOwner()->HasAuthority())
+	{
+		FireOnServer(origin, direction, GetWorld()->TimeSeconds);
+		return;
+	}
+
+	ACapbot * capbot = Cast<ACapbot>(GetOwner());
+	UCapbotMovementComponent * movement = capbot ? capbot->GetCapbotMovementComponent() : nullptr;
+	// Shot is rewound to what the shooter saw, not to the server's present
+	ServerFire(origin, direction, movement ? movement->GetViewServerTime() : GetWorld()->TimeSeconds);
+}
+void UCapbotProjectileLauncher::FireOnServer(const FVector& origin, const FVector& direction, float fireTime)
+{
+	const float now = GetWorld()->TimeSeconds;
+	if (lastFireTime >= 0.f && now - lastFireTime < refireSeconds)
+		return;
+	if (FVector::DistSquared(origin, GetOwner()->GetActorLocation()) > FMath::Square(maxOriginDistance))
+		return;
+	lastFireTime = now;
+
+	FCapbotProjectileParams params;
+	params.radius = projectileRadius;
+	params.gravityScale = projectileGravityScale;
+	params.lifeSeconds = projectileLifeSeconds;
+	FCapbotProjectileManager::Get(GetWorld())->Fire(GetOwner(), origin, direction * projectileSpeed, fireTime, params);
+}
+
+bool UCapbotProjectileLauncher::ServerFire_Validate(FVector_NetQuantize origin, FVector_NetQuantizeNormal direction, float timeStamp)
+{
+	return FMath::IsFinite(timeStamp);
+}
+void UCapbotProjectileLauncher::ServerFire_Implementation(FVector_NetQuantize origin, FVector_NetQuantizeNormal direction, float timeStamp)
+{
+	// Manager clamps how far into the past the shot goes
+	FireOnServer(origin, direction.GetSafeNormal(), timeStamp);
+}
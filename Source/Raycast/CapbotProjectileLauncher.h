@@ -0,0 +1,44 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "BaseModule.h"
+#include "Engine/NetSerialization.h"
+#include "CapbotProjectileLauncher.generated.h"
+
+/** Pawn module firing lag compensated projectiles, see FCapbotProjectileManager
+ * Owning client sends the shot with its estimate of server time, server simulates it from there
+ */
+UCLASS(ClassGroup = (Capbot), meta = (BlueprintSpawnableComponent))
+class RAYCAST_API UCapbotProjectileLauncher : public UBaseModule
+{
+	GENERATED_BODY()
+public:
+	UCapbotProjectileLauncher();
+
+	UFUNCTION(BlueprintCallable, Category = "Capbot|Projectiles")
+	void Fire(FVector origin, FVector direction);
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Capbot|Projectiles")
+	float projectileSpeed = 3000.f;
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Capbot|Projectiles")
+	float projectileRadius = 2.f;
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Capbot|Projectiles")
+	float projectileGravityScale = 0.f;
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Capbot|Projectiles")
+	float projectileLifeSeconds = 3.f;
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Capbot|Projectiles")
+	float refireSeconds = 0.1f;
+	// Server rejects shots from further than this from the pawn
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Capbot|Projectiles")
+	float maxOriginDistance = 200.f;
+
+protected:
+	void FireOnServer(const FVector& origin, const FVector& direction, float fireTime);
+
+	UFUNCTION(Server, Unreliable, WithValidation)
+	void ServerFire(FVector_NetQuantize origin, FVector_NetQuantizeNormal direction, float timeStamp);
+
+	float lastFireTime = -1.f;
+};
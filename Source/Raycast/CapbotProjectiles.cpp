@@ -0,0 +1,272 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CapbotProjectiles.h"
+#include "CapbotStaticCollision.h"
+#include "Engine/World.h"
+#include "Engine/Level.h"
+#include "GameFramework/Actor.h"
+
+DEFINE_STAT(STAT_CapbotProjectiles);
+DECLARE_CYCLE_STAT(TEXT("Projectiles tick"), STAT_CapbotProjectilesTick, STATGROUP_LagCompensation);
+
+float FCapbotProjectileManager::maxRewindSeconds = 0.5f;
+float FCapbotProjectileManager::maxSubstepSeconds = 1.f / 60.f;
+
+void FCapbotProjectileTickFunction::ExecuteTick(float DeltaTime, ELevelTick TickType, ENamedThreads::Type CurrentThread, const FGraphEventRef& MyCompletionGraphEvent)
+{
+	if (manager && TickType != LEVELTICK_ViewportsOnly)
+		manager->Tick(DeltaTime);
+}
+
+FCapbotProjectileManager::FCapbotProjectileManager(UWorld * inWorld)
+	: world(inWorld)
+{
+	// After pawns moved and async moves were applied, so present time poses are final
+	tickFunction.manager = this;
+	tickFunction.bCanEverTick = true;
+	tickFunction.TickGroup = TG_LastDemotable;
+	if (world && world->PersistentLevel)
+		tickFunction.RegisterTickFunction(world->PersistentLevel);
+}
+FCapbotProjectileManager::~FCapbotProjectileManager()
+{
+	if (tickFunction.IsTickFunctionRegistered())
+		tickFunction.UnRegisterTickFunction();
+	DEC_DWORD_STAT_BY(STAT_CapbotProjectiles, ids.Num());
+}
+
+int32 FCapbotProjectileManager::Fire(AActor * instigator, const FVector& origin, const FVector& velocity, float fireTime, const FCapbotProjectileParams& params)
+{
+	const float now = world->TimeSeconds;
+	const float time = FMath::Clamp(fireTime, now - maxRewindSeconds, now);
+
+	locationX.Add(origin.X);
+	locationY.Add(origin.Y);
+	locationZ.Add(origin.Z);
+	velocityX.Add(velocity.X);
+	velocityY.Add(velocity.Y);
+	velocityZ.Add(velocity.Z);
+	gravityZ.Add(world->GetGravityZ() * params.gravityScale);
+	radii.Add(FMath::Max(0.f, params.radius));
+	times.Add(time);
+	deathTimes.Add(time + params.lifeSeconds);
+	instigators.Add(instigator);
+	INC_DWORD_STAT(STAT_CapbotProjectiles);
+
+	const int32 id = nextId++;
+	ids.Add(id);
+	return id;
+}
+void FCapbotProjectileManager::RemoveAtSwap(int32 index)
+{
+	locationX.RemoveAtSwap(index, 1, false);
+	locationY.RemoveAtSwap(index, 1, false);
+	locationZ.RemoveAtSwap(index, 1, false);
+	velocityX.RemoveAtSwap(index, 1, false);
+	velocityY.RemoveAtSwap(index, 1, false);
+	velocityZ.RemoveAtSwap(index, 1, false);
+	gravityZ.RemoveAtSwap(index, 1, false);
+	radii.RemoveAtSwap(index, 1, false);
+	times.RemoveAtSwap(index, 1, false);
+	deathTimes.RemoveAtSwap(index, 1, false);
+	ids.RemoveAtSwap(index, 1, false);
+	instigators.RemoveAtSwap(index, 1, false);
+	DEC_DWORD_STAT(STAT_CapbotProjectiles);
+}
+
+void FCapbotProjectileManager::GatherTargets(float fromTime)
+{
+	FLagCompensateable::GetWorldCompensateables(world, targets);
+	targetActors.Reset();
+	targetBounds.Reset();
+
+	int32 kept = 0;
+	for (FLagCompensateable * target : targets)
+	{
+		FBox bounds;
+		AActor * actor = target->GetCompensateableActor();
+		if (!actor || !target->GetCompensatedBounds(fromTime, bounds))
+			continue;
+
+		targets[kept++] = target;
+		targetActors.Add(actor);
+		targetBounds.Add(bounds);
+	}
+	targets.SetNum(kept, false);
+}
+
+void FCapbotProjectileManager::Tick(float DeltaTime)
+{
+	SCOPE_CYCLE_COUNTER(STAT_CapbotProjectilesTick);
+
+	const int32 num = ids.Num();
+	if (num == 0)
+		return;
+
+	const float now = world->TimeSeconds;
+
+	float oldest = now;
+	for (int32 i = 0; i < num; ++i)
+		oldest = FMath::Min(oldest, times[i]);
+	GatherTargets(oldest);
+
+	startX.SetNumUninitialized(num, false);
+	startY.SetNumUninitialized(num, false);
+	startZ.SetNumUninitialized(num, false);
+	steps.SetNumUninitialized(num, false);
+
+	TArray<FCapbotProjectileHit, TInlineAllocator<16>> hits;
+
+	// Every pass moves each projectile by up to one substep, new ones catch up in a few passes
+	const int32 maxPasses = FMath::CeilToInt(maxRewindSeconds / maxSubstepSeconds) + 2;
+	for (int32 pass = 0; pass < maxPasses && ids.Num() > 0; ++pass)
+	{
+		const int32 count = ids.Num();
+		float * RESTRICT px = locationX.GetData();
+		float * RESTRICT py = locationY.GetData();
+		float * RESTRICT pz = locationZ.GetData();
+		float * RESTRICT vx = velocityX.GetData();
+		float * RESTRICT vy = velocityY.GetData();
+		float * RESTRICT vz = velocityZ.GetData();
+		float * RESTRICT sx = startX.GetData();
+		float * RESTRICT sy = startY.GetData();
+		float * RESTRICT sz = startZ.GetData();
+		float * RESTRICT dt = steps.GetData();
+		float * RESTRICT t = times.GetData();
+		const float * RESTRICT g = gravityZ.GetData();
+
+		// Straight loops over plain arrays, left to the compiler to vectorize
+		bool bAnyBehind = false;
+		for (int32 i = 0; i < count; ++i)
+		{
+			dt[i] = FMath::Clamp(now - t[i], 0.f, maxSubstepSeconds);
+			bAnyBehind |= dt[i] > 0.f;
+		}
+		if (!bAnyBehind)
+			break;
+
+		for (int32 i = 0; i < count; ++i)
+		{
+			sx[i] = px[i];
+			sy[i] = py[i];
+			sz[i] = pz[i];
+			vz[i] += g[i] * dt[i];
+			px[i] += vx[i] * dt[i];
+			py[i] += vy[i] * dt[i];
+			pz[i] += vz[i] * dt[i];
+			t[i] += dt[i];
+		}
+
+		removals.Reset();
+		for (int32 i = 0; i < count; ++i)
+		{
+			if (dt[i] <= 0.f)
+				continue;
+
+			const FVector start(sx[i], sy[i], sz[i]);
+			const FVector end(px[i], py[i], pz[i]);
+
+			float targetFraction = 1.f, staticFraction = 1.f;
+			FCapbotProjectileHit targetHit, staticHit;
+			// Poses are looked up at the end of the substep
+			const bool bHitTarget = TestTargets(i, start, end, t[i], targetFraction, targetHit);
+			const bool bHitStatic = TestStatic(i, start, end, staticFraction, staticHit);
+			if (bHitTarget || bHitStatic)
+			{
+				hits.Add(bHitTarget && (!bHitStatic || targetFraction <= staticFraction) ? targetHit : staticHit);
+				removals.Add(i);
+			}
+			else if (t[i] >= deathTimes[i])
+				removals.Add(i);
+		}
+
+		// Descending, so swapped in elements were already handled
+		for (int32 r = removals.Num() - 1; r >= 0; --r)
+			RemoveAtSwap(removals[r]);
+	}
+
+	// Handlers may destroy pawns, targets aren't touched after this
+	for (const FCapbotProjectileHit& hit : hits)
+		onHit.Broadcast(hit);
+}
+
+bool FCapbotProjectileManager::TestTargets(int32 index, const FVector& start, const FVector& end, float time, float& outFraction, FCapbotProjectileHit& outHit)
+{
+	const float radius = radii[index];
+	AActor * instigator = instigators[index].Get();
+
+	FBox segmentBounds(ForceInit);
+	segmentBounds += start;
+	segmentBounds += end;
+	segmentBounds = segmentBounds.ExpandBy(radius);
+
+	const float length = (end - start).Size();
+	bool bHit = false;
+	for (int32 i = 0; i < targets.Num(); ++i)
+	{
+		if (targetActors[i] == instigator || !targetBounds[i].Intersect(segmentBounds))
+			continue;
+
+		FVector center;
+		float capsuleRadius, halfHeight;
+		if (!targets[i]->GetCompensatedCapsule(time, center, capsuleRadius, halfHeight))
+			continue;
+
+		const FVector axis(0.f, 0.f, FMath::Max(0.f, halfHeight - capsuleRadius));
+		FVector onSegment, onAxis;
+		FMath::SegmentDistToSegmentSafe(start, end, center - axis, center + axis, onSegment, onAxis);
+		const float distance = (onSegment - onAxis).Size();
+		if (distance > capsuleRadius + radius)
+			continue;
+
+		const float fraction = length > KINDA_SMALL_NUMBER ? (onSegment - start).Size() / length : 0.f;
+		if (bHit && fraction >= outFraction)
+			continue;
+
+		bHit = true;
+		outFraction = fraction;
+		outHit.hitActor = targetActors[i];
+		outHit.normal = distance > KINDA_SMALL_NUMBER ? (onSegment - onAxis) / distance : -(end - start).GetSafeNormal();
+		outHit.location = onAxis + outHit.normal * capsuleRadius;
+	}
+
+	if (bHit)
+	{
+		outHit.id = ids[index];
+		outHit.instigator = instigators[index];
+		outHit.velocity = FVector(velocityX[index], velocityY[index], velocityZ[index]);
+		outHit.time = time;
+	}
+	return bHit;
+}
+bool FCapbotProjectileManager::TestStatic(int32 index, const FVector& start, const FVector& end, float& outFraction, FCapbotProjectileHit& outHit)
+{
+	const float radius = radii[index];
+
+	// Baked collision answers most of it without the physics scene
+	FHitResult hit(1.f);
+	const FCapbotStaticCollision * baked = FCapbotStaticCollision::Find(world);
+	if (!baked || !baked->SweepCapsule(hit, start, end - start, FQuat::Identity, FMath::Max(radius, 0.1f), FMath::Max(radius, 0.1f)))
+	{
+		static const FName traceTag(TEXT("CapbotProjectile"));
+		FCollisionQueryParams q(traceTag, false, instigators[index].Get());
+		const FCollisionObjectQueryParams objects(FCollisionObjectQueryParams::AllStaticObjects);
+		if (radius > 0.f)
+			world->SweepSingleByObjectType(hit, start, end, FQuat::Identity, objects, FCollisionShape::MakeSphere(radius), q);
+		else
+			world->LineTraceSingleByObjectType(hit, start, end, objects, q);
+	}
+
+	if (!hit.bBlockingHit)
+		return false;
+
+	outFraction = hit.Time;
+	outHit.id = ids[index];
+	outHit.instigator = instigators[index];
+	outHit.hitActor = nullptr;
+	outHit.location = hit.ImpactPoint;
+	outHit.normal = hit.ImpactNormal;
+	outHit.velocity = FVector(velocityX[index], velocityY[index], velocityZ[index]);
+	outHit.time = times[index] - steps[index] * (1.f - hit.Time);
+	return true;
+}
@@ -0,0 +1,99 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/EngineBaseTypes.h"
+#include "CapbotWorldRegistry.h"
+#include "FLagCompensateable.h"
+
+class UWorld;
+class AActor;
+class FCapbotProjectileManager;
+
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Projectiles"), STAT_CapbotProjectiles, STATGROUP_LagCompensation, RAYCAST_API);
+
+struct RAYCAST_API FCapbotProjectileParams
+{
+	float radius = 2.f;
+	float gravityScale = 0.f;
+	float lifeSeconds = 3.f;
+};
+
+struct RAYCAST_API FCapbotProjectileHit
+{
+	int32 id;
+	TWeakObjectPtr<AActor> instigator;
+	// Null for static world
+	TWeakObjectPtr<AActor> hitActor;
+	FVector location;
+	FVector normal;
+	FVector velocity;
+	// World time of the projectile at the hit, in the past while catching up
+	float time;
+};
+DECLARE_MULTICAST_DELEGATE_OneParam(FOnCapbotProjectileHit, const FCapbotProjectileHit&);
+
+struct FCapbotProjectileTickFunction : public FTickFunction
+{
+	FCapbotProjectileManager * manager = nullptr;
+
+	virtual void ExecuteTick(float DeltaTime, ELevelTick TickType, ENamedThreads::Type CurrentThread, const FGraphEventRef& MyCompletionGraphEvent) override;
+	virtual FString DiagnosticMessage() override { return TEXT("FCapbotProjectileManager::Tick"); }
+};
+
+/** Per-world server-authoritative projectiles, no actor per projectile
+ * A projectile starts at the shooter's (client) time and is simulated forward in substeps,
+ * colliding with lag compensated poses (FLagCompensateable::GetCompensatedCapsule) until it reaches present time.
+ * All projectiles are kept as structure of arrays and advanced together in every substep pass
+ */
+class RAYCAST_API FCapbotProjectileManager : public TCapbotWorldRegistry<FCapbotProjectileManager>
+{
+public:
+	// Fire times older than this are clamped
+	static float maxRewindSeconds;
+	static float maxSubstepSeconds;
+
+	FCapbotProjectileManager(UWorld * inWorld);
+	~FCapbotProjectileManager();
+
+	// Server only, fireTime is world time the shooter saw, returns projectile id
+	int32 Fire(AActor * instigator, const FVector& origin, const FVector& velocity, float fireTime, const FCapbotProjectileParams& params);
+	void Tick(float DeltaTime);
+
+	int32 Num() const { return ids.Num(); }
+
+	FOnCapbotProjectileHit onHit;
+
+private:
+	// Segment against collected targets at given time, fills hit with the closest one
+	bool TestTargets(int32 index, const FVector& start, const FVector& end, float time, float& outFraction, FCapbotProjectileHit& outHit);
+	bool TestStatic(int32 index, const FVector& start, const FVector& end, float& outFraction, FCapbotProjectileHit& outHit);
+	void GatherTargets(float fromTime);
+	void RemoveAtSwap(int32 index);
+
+	UWorld * world;
+	FCapbotProjectileTickFunction tickFunction;
+
+	// Projectiles
+	TArray<float> locationX, locationY, locationZ;
+	TArray<float> velocityX, velocityY, velocityZ;
+	TArray<float> gravityZ;
+	TArray<float> radii;
+	// World time each projectile is simulated up to
+	TArray<float> times;
+	TArray<float> deathTimes;
+	TArray<int32> ids;
+	TArray<TWeakObjectPtr<AActor>> instigators;
+	int32 nextId = 0;
+
+	// Per pass scratch
+	TArray<float> startX, startY, startZ;
+	TArray<float> steps;
+	TArray<int32> removals;
+
+	// Targets collected once per tick, bounds cover their poses from the oldest projectile time
+	TArray<FLagCompensateable*> targets;
+	TArray<AActor*> targetActors;
+	TArray<FBox> targetBounds;
+};
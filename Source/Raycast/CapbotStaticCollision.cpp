@@ -0,0 +1,421 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CapbotStaticCollision.h"
+#include "CapbotMovementComponent.h"
+#include "Engine/World.h"
+#include "EngineUtils.h"
+#include "Components/PrimitiveComponent.h"
+#include "PhysicsEngine/BodySetup.h"
+
+DECLARE_CYCLE_STAT(TEXT("Static collision build"), STAT_CapbotStaticCollisionBuild, STATGROUP_CapbotMovement);
+DECLARE_CYCLE_STAT(TEXT("Static collision sweep"), STAT_CapbotStaticCollisionSweep, STATGROUP_CapbotMovement);
+
+const float FCapbotStaticCollision::skinWidth = 0.1f;
+
+FDelegateHandle FCapbotStaticCollision::levelAddedHandle;
+FDelegateHandle FCapbotStaticCollision::levelRemovedHandle;
+
+namespace
+{
+	const int32 maxShapesPerLeaf = 4;
+	const int32 maxSweepIterations = 32;
+	const int32 segmentSearchIterations = 24;
+}
+
+FCapbotStaticCollision * FCapbotStaticCollision::Build(UWorld * world)
+{
+	if (!world)
+		return nullptr;
+
+	SCOPE_CYCLE_COUNTER(STAT_CapbotStaticCollisionBuild);
+
+	// Streamed levels are baked when they become visible
+	if (!levelAddedHandle.IsValid())
+	{
+		levelAddedHandle = FWorldDelegates::LevelAddedToWorld.AddStatic(&FCapbotStaticCollision::OnLevelsChanged);
+		levelRemovedHandle = FWorldDelegates::LevelRemovedFromWorld.AddStatic(&FCapbotStaticCollision::OnLevelsChanged);
+	}
+
+	FPtr baked(new FCapbotStaticCollision());
+
+	for (TActorIterator<AActor> it(world); it; ++it)
+	{
+		bool bMovable = false;
+		TInlineComponentArray<UPrimitiveComponent*> primitives(*it);
+		for (UPrimitiveComponent * primitive : primitives)
+		{
+			baked->AddComponent(primitive);
+			bMovable |= primitive->Mobility == EComponentMobility::Movable;
+		}
+		// Collision may be enabled later, blockers are recounted when queried
+		if (bMovable)
+			baked->movableActors.Add(*it);
+	}
+
+	baked->bakedWorld = world;
+	baked->actorSpawnedHandle = world->AddOnActorSpawnedHandler(FOnActorSpawned::FDelegate::CreateRaw(baked.Get(), &FCapbotStaticCollision::OnActorSpawned));
+
+	if (baked->shapes.Num() > 0)
+		baked->BuildNode(0, baked->shapes.Num());
+
+	baked->shapes.Shrink();
+	baked->nodes.Shrink();
+
+	int32 numFallback = 0;
+	for (const FShape& shape : baked->shapes)
+		if (shape.type == EShapeType::Fallback)
+			++numFallback;
+
+	UE_LOG(CapbotMovementComponentLog, Log, TEXT("Baked static collision: %d shapes (%d fallback), %d nodes, %d KB"),
+		baked->shapes.Num(), numFallback, baked->nodes.Num(), (int32)(baked->GetAllocatedSize() / 1024));
+
+	return Set(world, baked).Get();
+}
+FCapbotStaticCollision::~FCapbotStaticCollision()
+{
+	if (UWorld * world = bakedWorld.Get())
+		world->RemoveOnActorSpawnedHandler(actorSpawnedHandle);
+}
+void FCapbotStaticCollision::OnLevelsChanged(ULevel * level, UWorld * world)
+{
+	// Null level when the whole world is torn down
+	if (level && world && Find(world))
+		Build(world);
+}
+
+bool FCapbotStaticCollision::IsMovableBlocker(const UPrimitiveComponent * component)
+{
+	return component->IsRegistered() && component->Mobility == EComponentMobility::Movable &&
+		component->IsQueryCollisionEnabled() && component->GetCollisionResponseToChannel(ECC_Pawn) == ECR_Block;
+}
+bool FCapbotStaticCollision::HasMovableBlockers(const AActor * ignoredActor)
+{
+	if (movableBlockersFrame != GFrameCounter)
+	{
+		movableBlockersFrame = GFrameCounter;
+		numMovableBlockers = 0;
+		movableBlockerOwner = nullptr;
+		bOneMovableBlockerOwner = true;
+
+		for (int32 i = movableActors.Num() - 1; i >= 0; --i)
+		{
+			const AActor * actor = movableActors[i].Get();
+			if (!actor)
+			{
+				movableActors.RemoveAtSwap(i);
+				continue;
+			}
+
+			TInlineComponentArray<UPrimitiveComponent*> primitives(actor);
+			for (const UPrimitiveComponent * primitive : primitives)
+				if (IsMovableBlocker(primitive))
+				{
+					bOneMovableBlockerOwner &= !movableBlockerOwner || movableBlockerOwner == actor;
+					movableBlockerOwner = actor;
+					++numMovableBlockers;
+				}
+		}
+	}
+
+	return numMovableBlockers > 0 && !(bOneMovableBlockerOwner && movableBlockerOwner == ignoredActor);
+}
+
+void FCapbotStaticCollision::AddComponent(UPrimitiveComponent * component)
+{
+	// Stationary components are static bodies too, the physics fallback only looks at movable ones
+	if (!component || !component->IsRegistered() || component->Mobility == EComponentMobility::Movable)
+		return;
+	if (!component->IsQueryCollisionEnabled() || component->GetCollisionResponseToChannel(ECC_Pawn) != ECR_Block)
+		return;
+
+	const int32 componentIndex = components.Add(component);
+
+	UBodySetup * bodySetup = component->GetBodySetup();
+	if (!bodySetup ||
+		bodySetup->GetCollisionTraceFlag() == CTF_UseComplexAsSimple ||
+		bodySetup->AggGeom.ConvexElems.Num() > 0 ||
+		bodySetup->AggGeom.GetElementCount() == 0)
+	{
+		const FBoxSphereBounds& bounds = component->Bounds;
+		AddShape(EShapeType::Fallback, bounds.Origin, FQuat::Identity, bounds.BoxExtent, componentIndex);
+		return;
+	}
+
+	const FTransform& transform = component->GetComponentTransform();
+	const FVector scale = transform.GetScale3D().GetAbs();
+	const FQuat rotation = transform.GetRotation();
+
+	for (const FKBoxElem& box : bodySetup->AggGeom.BoxElems)
+		AddShape(EShapeType::Box, transform.TransformPosition(box.Center), rotation * box.Rotation.Quaternion(),
+			FVector(box.X, box.Y, box.Z) * 0.5f * scale, componentIndex);
+
+	for (const FKSphereElem& sphere : bodySetup->AggGeom.SphereElems)
+		AddShape(EShapeType::Sphere, transform.TransformPosition(sphere.Center), FQuat::Identity,
+			FVector(sphere.Radius * scale.GetMin(), 0.f, 0.f), componentIndex);
+
+	for (const FKSphylElem& sphyl : bodySetup->AggGeom.SphylElems)
+		AddShape(EShapeType::Capsule, transform.TransformPosition(sphyl.Center), rotation * sphyl.Rotation.Quaternion(),
+			FVector(sphyl.Radius * FMath::Max(scale.X, scale.Y), 0.f, sphyl.Length * 0.5f * scale.Z), componentIndex);
+}
+void FCapbotStaticCollision::AddShape(EShapeType type, const FVector& center, const FQuat& rotation, const FVector& extent, int32 component)
+{
+	FShape shape;
+	shape.center = center;
+	shape.extent = extent;
+	shape.rotation = rotation;
+	shape.type = type;
+	shape.component = component;
+
+	switch (type)
+	{
+	case EShapeType::Box:
+	{
+		const FVector worldExtent =
+			rotation.GetAxisX().GetAbs() * extent.X +
+			rotation.GetAxisY().GetAbs() * extent.Y +
+			rotation.GetAxisZ().GetAbs() * extent.Z;
+		shape.bounds = FBox::BuildAABB(center, worldExtent);
+		break;
+	}
+	case EShapeType::Sphere:
+		shape.bounds = FBox::BuildAABB(center, FVector(extent.X));
+		break;
+	case EShapeType::Capsule:
+		shape.bounds = FBox::BuildAABB(center, rotation.GetAxisZ().GetAbs() * extent.Z + FVector(extent.X));
+		break;
+	default:
+		shape.bounds = FBox::BuildAABB(center, extent);
+		break;
+	}
+
+	shapes.Add(shape);
+}
+int32 FCapbotStaticCollision::BuildNode(int32 first, int32 num)
+{
+	const int32 nodeIndex = nodes.AddUninitialized(1);
+
+	FBox bounds(ForceInit);
+	FBox centers(ForceInit);
+	for (int32 i = first; i < first + num; ++i)
+	{
+		bounds += shapes[i].bounds;
+		centers += shapes[i].bounds.GetCenter();
+	}
+	nodes[nodeIndex].boundsMin = bounds.Min;
+	nodes[nodeIndex].boundsMax = bounds.Max;
+
+	if (num <= maxShapesPerLeaf)
+	{
+		nodes[nodeIndex].index = first;
+		nodes[nodeIndex].numShapes = num;
+		return nodeIndex;
+	}
+
+	// Median split along the longest axis of shape centers
+	const FVector size = centers.GetSize();
+	const int32 axis = size.X >= size.Y && size.X >= size.Z ? 0 : (size.Y >= size.Z ? 1 : 2);
+	Sort(shapes.GetData() + first, num, [axis](const FShape& a, const FShape& b)
+	{
+		return a.bounds.GetCenter()[axis] < b.bounds.GetCenter()[axis];
+	});
+
+	const int32 half = num / 2;
+	BuildNode(first, half);
+	const int32 right = BuildNode(first + half, num - half);
+
+	nodes[nodeIndex].index = right;
+	nodes[nodeIndex].numShapes = 0;
+	return nodeIndex;
+}
+void FCapbotStaticCollision::GatherShapes(const FBox& box, TArray<int32, TInlineAllocator<32>>& outShapes) const
+{
+	if (nodes.Num() == 0)
+		return;
+
+	int32 stack[64];
+	int32 top = 0;
+	stack[top++] = 0;
+
+	while (top > 0)
+	{
+		const int32 nodeIndex = stack[--top];
+		const FNode& node = nodes[nodeIndex];
+
+		if (box.Min.X > node.boundsMax.X || box.Max.X < node.boundsMin.X ||
+			box.Min.Y > node.boundsMax.Y || box.Max.Y < node.boundsMin.Y ||
+			box.Min.Z > node.boundsMax.Z || box.Max.Z < node.boundsMin.Z)
+			continue;
+
+		if (node.numShapes > 0)
+		{
+			for (int32 i = node.index; i < node.index + node.numShapes; ++i)
+				if (shapes[i].bounds.Intersect(box))
+					outShapes.Add(i);
+		}
+		else
+		{
+			stack[top++] = nodeIndex + 1;
+			stack[top++] = node.index;
+		}
+	}
+}
+
+float FCapbotStaticCollision::SegmentDistance(const FShape& shape, const FVector& a, const FVector& b, FVector& outOnSegment, FVector& outOnShape)
+{
+	switch (shape.type)
+	{
+	case EShapeType::Sphere:
+	{
+		outOnSegment = FMath::ClosestPointOnSegment(shape.center, a, b);
+		const FVector direction = (outOnSegment - shape.center).GetSafeNormal();
+		outOnShape = shape.center + direction * shape.extent.X;
+		return (outOnSegment - shape.center).Size() - shape.extent.X;
+	}
+	case EShapeType::Capsule:
+	{
+		const FVector axis = shape.rotation.GetAxisZ() * shape.extent.Z;
+		FVector onAxis;
+		FMath::SegmentDistToSegmentSafe(a, b, shape.center - axis, shape.center + axis, outOnSegment, onAxis);
+		const FVector direction = (outOnSegment - onAxis).GetSafeNormal();
+		outOnShape = onAxis + direction * shape.extent.X;
+		return (outOnSegment - onAxis).Size() - shape.extent.X;
+	}
+	case EShapeType::Box:
+	{
+		// Distance to a convex set is convex along the segment, ternary search finds the minimum
+		auto closestOnBox = [&shape](const FVector& point) -> FVector
+		{
+			const FVector local = shape.rotation.UnrotateVector(point - shape.center);
+			const FVector clamped(
+				FMath::Clamp(local.X, -shape.extent.X, shape.extent.X),
+				FMath::Clamp(local.Y, -shape.extent.Y, shape.extent.Y),
+				FMath::Clamp(local.Z, -shape.extent.Z, shape.extent.Z));
+			return shape.center + shape.rotation.RotateVector(clamped);
+		};
+		auto distanceSquared = [&](float alpha) -> float
+		{
+			const FVector point = FMath::Lerp(a, b, alpha);
+			return FVector::DistSquared(point, closestOnBox(point));
+		};
+
+		float low = 0.f;
+		float high = 1.f;
+		for (int32 i = 0; i < segmentSearchIterations; ++i)
+		{
+			const float third = (high - low) / 3.f;
+			if (distanceSquared(low + third) < distanceSquared(high - third))
+				high = high - third;
+			else
+				low = low + third;
+		}
+
+		outOnSegment = FMath::Lerp(a, b, (low + high) * 0.5f);
+		outOnShape = closestOnBox(outOnSegment);
+		return (outOnSegment - outOnShape).Size();
+	}
+	default:
+		outOnSegment = a;
+		outOnShape = shape.center;
+		return 0.f;
+	}
+}
+
+bool FCapbotStaticCollision::SweepCapsule(FHitResult& hit, const FVector& start, const FVector& delta, const FQuat& rotation, float radius, float halfHeight) const
+{
+	int32 component = INDEX_NONE;
+	if (!SweepCapsule(hit, component, start, delta, rotation, radius, halfHeight))
+		return false;
+
+	if (UPrimitiveComponent * hitComponent = GetComponent(component))
+	{
+		hit.Component = hitComponent;
+		hit.Actor = hitComponent->GetOwner();
+	}
+	return true;
+}
+bool FCapbotStaticCollision::SweepCapsule(FHitResult& hit, int32& outComponent, const FVector& start, const FVector& delta, const FQuat& rotation, float radius, float halfHeight) const
+{
+	SCOPE_CYCLE_COUNTER(STAT_CapbotStaticCollisionSweep);
+
+	outComponent = INDEX_NONE;
+	hit = FHitResult(1.f);
+	hit.TraceStart = start;
+	hit.TraceEnd = start + delta;
+
+	const FVector axis = rotation.GetAxisZ() * FMath::Max(0.f, halfHeight - radius);
+
+	FBox sweptBox(ForceInit);
+	sweptBox += start - axis;
+	sweptBox += start + axis;
+	sweptBox += start + delta - axis;
+	sweptBox += start + delta + axis;
+	sweptBox = sweptBox.ExpandBy(radius + skinWidth * 2.f);
+
+	TArray<int32, TInlineAllocator<32>> candidates;
+	GatherShapes(sweptBox, candidates);
+
+	for (int32 candidate : candidates)
+		if (shapes[candidate].type == EShapeType::Fallback)
+			return false;
+
+	const float deltaSize = delta.Size();
+	if (candidates.Num() == 0 || deltaSize < KINDA_SMALL_NUMBER)
+		return true;
+
+	// Conservative advancement: the gap can't shrink faster than the capsule moves.
+	// A shape we move away from never gets closer along a straight sweep, so it is dropped
+	TArray<bool, TInlineAllocator<32>> separating;
+	separating.SetNumZeroed(candidates.Num());
+
+	float time = 0.f;
+	for (int32 iteration = 0; iteration < maxSweepIterations; ++iteration)
+	{
+		const FVector location = start + delta * time;
+
+		float minGap = BIG_NUMBER;
+		for (int32 i = 0; i < candidates.Num(); ++i)
+		{
+			if (separating[i])
+				continue;
+
+			const FShape& shape = shapes[candidates[i]];
+			FVector onSegment, onShape;
+			const float distance = SegmentDistance(shape, location - axis, location + axis, onSegment, onShape);
+			const float gap = distance - radius;
+
+			if (distance <= KINDA_SMALL_NUMBER || gap < -skinWidth)
+				return false; // Penetrating, let physics resolve it
+
+			const FVector normal = (onSegment - onShape) / distance;
+			if (FVector::DotProduct(delta, normal) >= 0.f)
+			{
+				separating[i] = true;
+				continue;
+			}
+
+			if (gap <= skinWidth * 2.f)
+			{
+				hit.bBlockingHit = true;
+				hit.Time = time;
+				hit.Distance = deltaSize * time;
+				hit.Location = location;
+				hit.ImpactPoint = onShape;
+				hit.Normal = normal;
+				hit.ImpactNormal = normal;
+				outComponent = shape.component;
+				return true;
+			}
+
+			minGap = FMath::Min(minGap, gap);
+		}
+
+		if (minGap == BIG_NUMBER)
+			return true; // Nothing left in the way
+
+		time += (minGap - skinWidth) / deltaSize;
+		if (time >= 1.f)
+			return true;
+	}
+
+	return false; // Did not converge
+}
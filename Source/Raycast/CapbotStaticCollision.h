@@ -0,0 +1,115 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/EngineTypes.h"
+#include "CapbotWorldRegistry.h"
+
+class UWorld;
+class ULevel;
+class AActor;
+class UPrimitiveComponent;
+
+/** Baked copy of the world's static simple collision for fast capsule sweeps
+ * Boxes, spheres and capsules of components that can't move (static and stationary) are
+ * flattened into a BVH at map load, and rebaked when a level streams in or out. Everything else
+ * (convex hulls, complex-as-simple meshes, landscapes) is kept as a fallback volume:
+ * sweeps touching one are left to the physics scene. Movable blockers are tracked so the physics
+ * sweep for them can be skipped while there are none
+ */
+class RAYCAST_API FCapbotStaticCollision : public TCapbotWorldRegistry<FCapbotStaticCollision, ESPMode::ThreadSafe>
+{
+public:
+	enum class EShapeType : uint8
+	{
+		Box, Sphere, Capsule, Fallback
+	};
+
+	struct FShape
+	{
+		FVector center;
+		// Box: half extents; Sphere: X is radius; Capsule: X is radius, Z is half length of the segment
+		FVector extent;
+		FQuat rotation;
+		FBox bounds;
+		EShapeType type;
+		int32 component;
+	};
+
+	// Depth-first flattened node, left child always follows its parent
+	struct FNode
+	{
+		FVector boundsMin;
+		// Inner node: index of the right child; leaf: first shape
+		int32 index;
+		FVector boundsMax;
+		// Zero for inner nodes
+		int32 numShapes;
+	};
+
+	// Distance kept between capsule and baked surfaces after a sweep
+	static const float skinWidth;
+
+	~FCapbotStaticCollision();
+
+	// Bakes static collision of the world, replaces previous bake
+	static FCapbotStaticCollision * Build(UWorld * world);
+	static FCapbotStaticCollision * Find(const UWorld * world) { return FindShared(world).Get(); }
+	// Keeps the bake alive while a worker sweeps it, a rebake replaces it
+	static FPtr FindShared(const UWorld * world) { return TCapbotWorldRegistry::Find(world); }
+
+	/*
+	* Sweeps vertical-axis-aligned capsule. Returns false if baked data can't answer
+	* (fallback volume on the way, starting in penetration) and physics scene should be used
+	*/
+	bool SweepCapsule(FHitResult& hit, const FVector& start, const FVector& delta, const FQuat& rotation, float radius, float halfHeight) const;
+	/*
+	* Same sweep touching no UObjects, safe off the game thread. hit has no component or actor,
+	* outComponent is the baked component index of a blocking hit (INDEX_NONE otherwise) for GetComponent
+	*/
+	bool SweepCapsule(FHitResult& hit, int32& outComponent, const FVector& start, const FVector& delta, const FQuat& rotation, float radius, float halfHeight) const;
+	// Game thread
+	UPrimitiveComponent * GetComponent(int32 index) const { return components.IsValidIndex(index) ? components[index].Get() : nullptr; }
+
+	/*
+	* Whether a movable primitive blocking pawns belongs to another actor than ignoredActor.
+	* Recounted once per frame, game thread
+	*/
+	bool HasMovableBlockers(const AActor * ignoredActor);
+
+	int32 GetNumShapes() const { return shapes.Num(); }
+	int32 GetNumNodes() const { return nodes.Num(); }
+	SIZE_T GetAllocatedSize() const { return shapes.GetAllocatedSize() + nodes.GetAllocatedSize() + components.GetAllocatedSize(); }
+
+private:
+	// Rebakes worlds that have a bake when their levels change
+	static void OnLevelsChanged(ULevel * level, UWorld * world);
+	static bool IsMovableBlocker(const UPrimitiveComponent * component);
+	void OnActorSpawned(AActor * actor) { movableActors.Add(actor); }
+
+	void AddComponent(UPrimitiveComponent * component);
+	void AddShape(EShapeType type, const FVector& center, const FQuat& rotation, const FVector& extent, int32 component);
+	int32 BuildNode(int32 first, int32 num);
+	void GatherShapes(const FBox& box, TArray<int32, TInlineAllocator<32>>& outShapes) const;
+
+	// Distance between segment [a, b] and the shape surface, negative inside round shapes
+	static float SegmentDistance(const FShape& shape, const FVector& a, const FVector& b, FVector& outOnSegment, FVector& outOnShape);
+
+	TArray<FShape> shapes;
+	TArray<FNode> nodes;
+	TArray<TWeakObjectPtr<UPrimitiveComponent>> components;
+
+	// Actors that may own movable blockers: the ones with movable primitives at bake and all spawned since
+	TArray<TWeakObjectPtr<AActor>> movableActors;
+	TWeakObjectPtr<UWorld> bakedWorld;
+	FDelegateHandle actorSpawnedHandle;
+	uint64 movableBlockersFrame = 0;
+	int32 numMovableBlockers = 0;
+	// Owner of the blockers when they all belong to one actor
+	const AActor * movableBlockerOwner = nullptr;
+	bool bOneMovableBlockerOwner = false;
+
+	static FDelegateHandle levelAddedHandle;
+	static FDelegateHandle levelRemovedHandle;
+};
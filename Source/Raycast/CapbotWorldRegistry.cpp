@@ -0,0 +1,20 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CapbotWorldRegistry.h"
+
+void FCapbotWorldRegistries::Add(FReleaseWorldFunction releaseWorld)
+{
+	GetReleaseFunctions().Add(releaseWorld);
+}
+void FCapbotWorldRegistries::ReleaseWorld(const UWorld * world)
+{
+	// Releasing may touch a registry for the first time, it is added past the ones left to go
+	TArray<FReleaseWorldFunction>& releaseFunctions = GetReleaseFunctions();
+	for (int32 i = releaseFunctions.Num() - 1; i >= 0; --i)
+		releaseFunctions[i](world);
+}
+TArray<FCapbotWorldRegistries::FReleaseWorldFunction>& FCapbotWorldRegistries::GetReleaseFunctions()
+{
+	static TArray<FReleaseWorldFunction> releaseFunctions;
+	return releaseFunctions;
+}
@@ -0,0 +1,75 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class UWorld;
+
+/** Every TCapbotWorldRegistry, so a world being torn down is released from all of them at once
+ * Registries add themselves on first use and are released in reverse order of that
+ */
+class RAYCAST_API FCapbotWorldRegistries
+{
+public:
+	typedef void(*FReleaseWorldFunction)(const UWorld*);
+
+	static void Add(FReleaseWorldFunction releaseWorld);
+	// Called by FRaycastModule on world cleanup, on every net mode
+	static void ReleaseWorld(const UWorld * world);
+
+private:
+	static TArray<FReleaseWorldFunction>& GetReleaseFunctions();
+};
+
+/** One shared T per world, T derives from it to get Get/Find/Release
+ * Game thread only: a worker keeps its own copy of the pointer. Get constructs T from the world,
+ * T::OnWorldReleased (hides the empty one here) runs before the registry forgets an instance
+ */
+template <typename T, ESPMode Mode = ESPMode::NotThreadSafe>
+class TCapbotWorldRegistry
+{
+public:
+	typedef TSharedPtr<T, Mode> FPtr;
+
+	// Finds or creates instance of the world
+	template <typename TWorld>
+	static FPtr Get(TWorld * world)
+	{
+		if (const FPtr * found = GetInstances().Find(world))
+			return *found;
+		return Set(world, FPtr(new T(world)));
+	}
+	static FPtr Find(const UWorld * world)
+	{
+		const FPtr * found = GetInstances().Find(world);
+		return found ? *found : FPtr();
+	}
+	// Replaces instance of the world
+	static FPtr Set(const UWorld * world, const FPtr& instance)
+	{
+		GetInstances().Add(world, instance);
+		return instance;
+	}
+	// Forgets instance of the world, it goes away with the last pointer to it
+	static void Release(const UWorld * world)
+	{
+		FPtr instance;
+		if (GetInstances().RemoveAndCopyValue(world, instance) && instance.IsValid())
+			instance->OnWorldReleased();
+	}
+	static void GetWorlds(TArray<const UWorld*>& outWorlds) { GetInstances().GetKeys(outWorlds); }
+
+	void OnWorldReleased() {}
+
+private:
+	struct FInstances : public TMap<const UWorld*, FPtr>
+	{
+		FInstances() { FCapbotWorldRegistries::Add(&TCapbotWorldRegistry::Release); }
+	};
+	static FInstances& GetInstances()
+	{
+		static FInstances instances;
+		return instances;
+	}
+};
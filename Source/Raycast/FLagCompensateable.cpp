@@ -5,20 +5,73 @@
 DEFINE_STAT(STAT_LagCompensate);
 DEFINE_STAT(STAT_LagDecompensate);
 
-TArray<FLagCompensateable*> FLagCompensateable::compensateables;
+void FLagCompensateable::FWorldCompensateables::OnWorldReleased()
+{
+	for (FLagCompensateable * compensateable : compensateables)
+		if (compensateable)
+			compensateable->registeredWorld = nullptr;
+}
 
-void FLagCompensateable::Compensate(float amount, UWorld * world)
+void FLagCompensateable::RegisterCompensateable(const UWorld * world)
 {
-	bool bNeedsCleanup = false;
+	if (registeredWorld == world)
+		return;
+
+	UnregisterCompensateable();
+	if (!world)
+		return;
+
+	FWorldCompensateables::Get(world)->compensateables.Add(this);
+	registeredWorld = world;
+}
+void FLagCompensateable::UnregisterCompensateable()
+{
+	if (!registeredWorld)
+		return;
 
+	if (TSharedPtr<FWorldCompensateables> worldCompensateables = FWorldCompensateables::Find(registeredWorld))
+	{
+		const int32 pos = worldCompensateables->compensateables.Find(this);
+		if (pos >= 0)
+			worldCompensateables->compensateables[pos] = nullptr;
+	}
+	registeredWorld = nullptr;
+}
+
+void FLagCompensateable::GetWorldCompensateables(const UWorld * world, TArray<FLagCompensateable*>& outCompensateables)
+{
+	outCompensateables.Reset();
+	if (TSharedPtr<FWorldCompensateables> worldCompensateables = FWorldCompensateables::Find(world))
+		for (FLagCompensateable * compensateable : worldCompensateables->compensateables)
+			if (compensateable)
+				outCompensateables.Add(compensateable);
+}
+
+void FLagCompensateable::Compensate(float amount, UWorld * world)
+{
 	SCOPE_CYCLE_COUNTER(STAT_LagCompensate);
 
+	if (world == nullptr)
+	{
+		TArray<const UWorld*> worlds;
+		FWorldCompensateables::GetWorlds(worlds);
+		for (const UWorld * eachWorld : worlds)
+			Compensate(amount, const_cast<UWorld*>(eachWorld));
+		return;
+	}
+
+	TSharedPtr<FWorldCompensateables> worldCompensateables = FWorldCompensateables::Find(world);
+	if (!worldCompensateables.IsValid())
+		return;
+	TArray<FLagCompensateable*>& compensateables = worldCompensateables->compensateables;
+
+	bool bNeedsCleanup = false;
+
 	for (int i = 0; i < compensateables.Num(); ++i)
 	{
 		if (FLagCompensateable * compensateable = compensateables[i])
 		{
 			if (compensateable->AllowCompensation() &&
-				(compensateable->GetCompensateableWorld() == world || world == nullptr) &&
 				!compensateable->bIsCompensated)
 			{
 				compensateable->CompensateSeconds(amount);
@@ -39,16 +92,29 @@ void FLagCompensateable::Compensate(float amount, UWorld * world)
 
 void FLagCompensateable::Decompensate(UWorld * world)
 {
-	bool bNeedsCleanup = false;
-
 	SCOPE_CYCLE_COUNTER(STAT_LagDecompensate);
 
+	if (world == nullptr)
+	{
+		TArray<const UWorld*> worlds;
+		FWorldCompensateables::GetWorlds(worlds);
+		for (const UWorld * eachWorld : worlds)
+			Decompensate(const_cast<UWorld*>(eachWorld));
+		return;
+	}
+
+	TSharedPtr<FWorldCompensateables> worldCompensateables = FWorldCompensateables::Find(world);
+	if (!worldCompensateables.IsValid())
+		return;
+	TArray<FLagCompensateable*>& compensateables = worldCompensateables->compensateables;
+
+	bool bNeedsCleanup = false;
+
 	for (int i = 0; i < compensateables.Num(); ++i)
 	{
 		if (FLagCompensateable * compensateable = compensateables[i])
 		{
 			if (compensateable->AllowCompensation() &&
-				(compensateable->GetCompensateableWorld() == world || world == nullptr) &&
 				compensateable->bIsCompensated)
 			{
 				compensateable->RevertCompensation();
@@ -4,36 +4,49 @@
 
 #include "CoreMinimal.h"
 #include "Stats/Stats.h"
+#include "CapbotHistoryArena.h"
+#include "CapbotWorldRegistry.h"
 //#include "RayGameStateBase.h"
 
 DECLARE_STATS_GROUP(TEXT("LagCompensation"), STATGROUP_LagCompensation, STATCAT_Advanced);
 DECLARE_CYCLE_STAT_EXTERN(TEXT("Compensate"), STAT_LagCompensate, STATGROUP_LagCompensation, RAYCAST_API);
 DECLARE_CYCLE_STAT_EXTERN(TEXT("Decompensate"), STAT_LagDecompensate, STATGROUP_LagCompensation, RAYCAST_API);
 
-/** Provides lag compensation interface-like class with autmatic registration
- * 
+class UWorld;
+class AActor;
+
+/** Provides lag compensation interface-like class with per-world registration
+ * Each world has its own registry, so worlds never touch each other's compensateables
  */
 class RAYCAST_API FLagCompensateable
 {
-	static TArray<FLagCompensateable*> compensateables;
+	// Compensateables of one world, unregistered ones are nulled and removed by the next pass
+	struct FWorldCompensateables : public TCapbotWorldRegistry<FWorldCompensateables>
+	{
+		TArray<FLagCompensateable*> compensateables;
+
+		FWorldCompensateables(const UWorld *) {}
+		// Compensateables still registered forget the world
+		void OnWorldReleased();
+	};
 
 	// Is this compensateable has been compensated?
 	bool bIsCompensated = false;
+	// World registered in, nullptr if not registered
+	const UWorld * registeredWorld = nullptr;
+
 public:
 
-	FLagCompensateable() 
-	{
-		//check(!compensateables.Contains(this));
-		compensateables.Add(this);
-	}
+	FLagCompensateable() {}
 	virtual ~FLagCompensateable() 
 	{
-		const int32 pos = compensateables.Find(this);
-		//check(pos != INDEX_NONE);
-		if (pos >= 0)
-			compensateables[pos] = nullptr;
+		UnregisterCompensateable();
 	}
 
+	// Called once world is known (BeginPlay)
+	void RegisterCompensateable(const UWorld * world);
+	void UnregisterCompensateable();
+
 	bool IsCompensated() { return bIsCompensated; }
 
 	// Rewind given seconds into past
@@ -44,11 +57,23 @@ public:
 	virtual bool AllowCompensation() = 0;
 	// Get world this object is working from, used to filter compensateables from different UWorlds
 	virtual UWorld * GetCompensateableWorld() = 0;
-
-	// Rewind time for every registered compensateable
+	// Actor this object belongs to, so queries can skip the instigator
+	virtual AActor * GetCompensateableActor() { return nullptr; }
+
+	/*
+	* Queries for batched tests that don't move anything, false if the object can't answer them
+	*/
+	// Vertical collision capsule at given world time
+	virtual bool GetCompensatedCapsule(float worldTime, FVector& outCenter, float& outRadius, float& outHalfHeight) { return false; }
+	// Everything the capsule covered from given world time until now
+	virtual bool GetCompensatedBounds(float fromWorldTime, FBox& outBounds) { return false; }
+
+	// Rewind time for every compensateable registered in the world, all worlds if nullptr
 	static void Compensate(float amount, UWorld * world);
-	// Revert rewinding of the time for every registered compensateable
+	// Revert rewinding of the time for every compensateable registered in the world, all worlds if nullptr
 	static void Decompensate(UWorld * world);
+	// Compensateables registered in the world
+	static void GetWorldCompensateables(const UWorld * world, TArray<FLagCompensateable*>& outCompensateables);
 };
 
 /*class FScopedLagCompensation 
@@ -66,55 +91,108 @@ public:
 	}
 };*/
 
+/** Interpolation used by TCompensationDataMemory, alpha is between saved points deltaSeconds apart
+ * Overload it next to a type that can do better than Lerp, it's found by argument dependent lookup
+ */
+template <typename T>
+T InterpolateCompensationData(const T& a, const T& b, float alpha, float deltaSeconds)
+{
+	return FMath::Lerp(a, b, alpha);
+}
+inline FQuat InterpolateCompensationData(const FQuat& a, const FQuat& b, float alpha, float deltaSeconds)
+{
+	return FQuat::Slerp(a, b, alpha);
+}
+inline FRotator InterpolateCompensationData(const FRotator& a, const FRotator& b, float alpha, float deltaSeconds)
+{
+	return FQuat::Slerp(a.Quaternion(), b.Quaternion(), alpha).Rotator();
+}
+inline FTransform InterpolateCompensationData(const FTransform& a, const FTransform& b, float alpha, float deltaSeconds)
+{
+	FTransform result;
+	result.Blend(a, b, alpha);
+	return result;
+}
+
 template <typename T>
 class RAYCAST_API TCompensationDataMemory
 {
-	TArray<TTuple<float, T>> savedData;
+	// Oldest first, kept in one block of the world's history arena
+	TCapbotHistory<TTuple<float, T>> savedData;
 public:
 	float maxMemoryTimeSeconds = 1.f;
 
+	// Has to be called before saving anything, capacity is what fits the arena block
+	bool Allocate(const UWorld * world, int32 maxEntries = MAX_int32)
+	{
+		return savedData.Allocate(FCapbotHistoryArena::Get(world), maxEntries);
+	}
+	void Free() { savedData.Free(); }
+	void Reset() { savedData.Reset(); }
+	int32 Num() const { return savedData.Num(); }
+	SIZE_T GetAllocatedSize() const { return savedData.GetAllocatedSize(); }
+
 	void CleanUp() 
 	{
 		if (savedData.Num() == 0)
 			return;
 
-		float elimTime = savedData[0].Get<0>() - maxMemoryTimeSeconds;
+		float elimTime = savedData.Last().template Get<0>() - maxMemoryTimeSeconds;
 		
-		savedData.RemoveAll([elimTime](const TTuple<float, T>& data)->bool { return data.Get<0>() < elimTime; });
+		savedData.RemoveAll([elimTime](const TTuple<float, T>& data)->bool { return data.template Get<0>() < elimTime; });
 	}
 
-	template <typename T>
-	void Save(T data, float timePoint) 
+	void Save(const T& data, float timePoint) 
 	{
-		if (savedData.Num() == 0)
-			savedData.Add(TTuple<float, T>( timePoint, data ));
-		else if (savedData[0].Get<0>() < timePoint)
-			savedData.Insert(TTuple<float, T>(timePoint, data), 0);
+		if (savedData.Num() > 0 && savedData.Last().template Get<0>() > timePoint)
+			return;
+		// Latest data of the same time point wins
+		if (savedData.Num() > 0 && savedData.Last().template Get<0>() == timePoint)
+		{
+			savedData.Last().template Get<1>() = data;
+			return;
+		}
+
+		// Full, forget the oldest
+		if (savedData.Num() == savedData.Max() && savedData.Num() > 0)
+			savedData.RemoveAt(0);
+
+		savedData.Add(TTuple<float, T>(timePoint, data));
 
 		CleanUp();
 	}
 	
-	template <typename T>
-	T Get(float second) 
+	T Get(float second) const
 	{
 		if (savedData.Num() == 0)
 			return T();
 		else if (savedData.Num() == 1)
-			return savedData[0].Get<1>();
+			return savedData[0].template Get<1>();
 
-		if (savedData[0].Get<0>() <= second)
-			return savedData[0].Get<1>();
-		else if (savedData.Last().Get<0>() > second)
-			return savedData.Last().Get<1>();
+		if (savedData.Last().template Get<0>() <= second)
+			return savedData.Last().template Get<1>();
+		else if (savedData[0].template Get<0>() >= second) // Outdated second (too high ping?)
+			return savedData[0].template Get<1>();
 
-		TTuple<float, T> * foundData = savedData.FindByPredicate([second](const TTuple<float, T>& data)->bool { return data.Get<0>() < second; });
-		
-		if (foundData == nullptr) // Outdated second (too high ping?)
-			return savedData.Last().Get<1>();
+		int32 next = 1;
+		while (savedData[next].template Get<0>() < second)
+			++next;
+
+		const TTuple<float, T>& before = savedData[next - 1];
+		const TTuple<float, T>& after = savedData[next];
 
-		// (Try) Interpolate
-		float alpha = (second - (*foundData).Get<0>()) / ((*(foundData - 1)).Get<0>() - (*foundData).Get<0>());
+		const float deltaSeconds = after.template Get<0>() - before.template Get<0>();
+		const float alpha = (second - before.template Get<0>()) / deltaSeconds;
 
-		return FMath::Lerp( (*(foundData)).Get<1>(), (*(foundData - 1)).Get<1>(), alpha);
+		return InterpolateCompensationData(before.template Get<1>(), after.template Get<1>(), alpha, deltaSeconds);
+	}
+
+	// Calls func(timePoint, data) for everything saved since given second, including the last point before it
+	template <typename Func>
+	void ForEachSince(float second, const Func& func) const
+	{
+		for (int32 i = 0; i < savedData.Num(); ++i)
+			if (i + 1 == savedData.Num() || savedData[i + 1].template Get<0>() > second)
+				func(savedData[i].template Get<0>(), savedData[i].template Get<1>());
 	}
 };
\ No newline at end of file
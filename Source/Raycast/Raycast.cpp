@@ -1,6 +1,43 @@
 // Fill out your copyright notice in the Description page of Project Settings.
 
 #include "Raycast.h"
-#include "Modules/ModuleManager.h"
+#include "Engine/World.h"
+#include "CapbotAsyncSimulation.h"
+#include "CapbotStaticCollision.h"
+#include "CapbotWorldRegistry.h"
+#include "HAL/IConsoleManager.h"
 
-IMPLEMENT_PRIMARY_GAME_MODULE( FDefaultGameModuleImpl, Raycast, "Raycast" );
+IMPLEMENT_PRIMARY_GAME_MODULE( FRaycastModule, Raycast, "Raycast" );
+
+// Console variable rather than a game mode setting, clients have to know it before the game mode replicates
+static TAutoConsoleVariable<int32> CVarBakeStaticCollision(
+	TEXT("Capbot.BakeStaticCollision"),
+	1,
+	TEXT("Bake static collision at map load for Capbot movement on server and clients"),
+	ECVF_Default);
+
+void FRaycastModule::StartupModule()
+{
+	worldCleanupHandle = FWorldDelegates::OnWorldCleanup.AddStatic(&FRaycastModule::OnWorldCleanup);
+	worldInitializedActorsHandle = FWorldDelegates::OnWorldInitializedActors.AddStatic(&FRaycastModule::OnWorldInitializedActors);
+}
+void FRaycastModule::ShutdownModule()
+{
+	FWorldDelegates::OnWorldCleanup.Remove(worldCleanupHandle);
+	FWorldDelegates::OnWorldInitializedActors.Remove(worldInitializedActorsHandle);
+}
+void FRaycastModule::OnWorldInitializedActors(const UWorld::FActorsInitializedParams& params)
+{
+	UWorld * world = params.World;
+	if (!world || !world->IsGameWorld() || CVarBakeStaticCollision.GetValueOnGameThread() == 0)
+		return;
+
+	FCapbotStaticCollision::Build(world);
+	// Async simulation only runs server-controlled moves against baked collision
+	if (world->GetNetMode() != NM_Client)
+		FCapbotAsyncSimulation::Get(world);
+}
+void FRaycastModule::OnWorldCleanup(UWorld * world, bool bSessionEnded, bool bCleanupResources)
+{
+	FCapbotWorldRegistries::ReleaseWorld(world);
+}
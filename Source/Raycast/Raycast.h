@@ -3,4 +3,21 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "Modules/ModuleManager.h"
+#include "Engine/World.h"
 
+class FRaycastModule : public FDefaultGameModuleImpl
+{
+public:
+	virtual void StartupModule() override;
+	virtual void ShutdownModule() override;
+
+private:
+	// Per-world registries live as long as their world on every net mode
+	static void OnWorldCleanup(UWorld * world, bool bSessionEnded, bool bCleanupResources);
+	// Static collision is baked on clients too, predicted moves have to match the server's
+	static void OnWorldInitializedActors(const UWorld::FActorsInitializedParams& params);
+
+	FDelegateHandle worldCleanupHandle;
+	FDelegateHandle worldInitializedActorsHandle;
+};
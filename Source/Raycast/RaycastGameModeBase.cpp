@@ -1,7 +1,168 @@
 // Fill out your copyright notice in the Description page of Project Settings.
 
 #include "RaycastGameModeBase.h"
+#include "CapbotHistoryArena.h"
+#include "CapbotNetTelemetry.h"
+#include "CapbotMovementComponent.h"
+#include "Capbot.h"
+#include "Engine/World.h"
+#include "GameFramework/Controller.h"
+#include "GameFramework/PlayerController.h"
+#include "GameFramework/PlayerState.h"
+#include "Engine/NetConnection.h"
+#include "TimerManager.h"
+#include "Misc/Paths.h"
 
+void ARaycastGameModeBase::StartPlay()
+{
+	FCapbotHistoryArena::Get(GetWorld())->SetBudget((int64)historyMemoryBudgetMB * 1024 * 1024);
 
+	if (bUseCapbotPool && DefaultPawnClass && DefaultPawnClass->IsChildOf(ACapbot::StaticClass()))
+	{
+		pooledCapbots.Reserve(poolMaxSize);
+		for (int32 i = 0; i < FMath::Min(poolPrewarmSize, poolMaxSize); ++i)
+			if (ACapbot * capbot = SpawnCapbot(*DefaultPawnClass, FTransform::Identity))
+			{
+				capbot->OnReturnedToPool();
+				pooledCapbots.Add(capbot);
+			}
+	}
 
+	if (bExportNetTelemetry && telemetryInterval > 0.f)
+	{
+		const bool bPrometheus = telemetryFormat == ECapbotTelemetryFormat::Prometheus;
+		const FString path = FPaths::ProjectSavedDir() / TEXT("Telemetry") / telemetryFileName + (bPrometheus ? TEXT(".prom") : TEXT(".csv"));
+		netTelemetry = MakeShareable(new FCapbotNetTelemetry(path, bPrometheus, (int64)telemetryMaxFileMB * 1024 * 1024, telemetryFilesKept));
+		lastTelemetryTime = FPlatformTime::Seconds();
+		GetWorldTimerManager().SetTimer(netTelemetryTimer, this, &ARaycastGameModeBase::WriteNetTelemetry, telemetryInterval, true);
+	}
 
+	Super::StartPlay();
+}
+void ARaycastGameModeBase::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	GetWorldTimerManager().ClearTimer(netTelemetryTimer);
+	netTelemetry.Reset();
+
+	if (poolRequests > 0)
+		UE_LOG(CapbotMovementComponentLog, Log, TEXT("Capbot pool: %d requests, %.1f%% hits, %.3f ms average spawn"),
+			poolRequests, GetPoolHitRate() * 100.f, GetAverageSpawnMilliseconds());
+	pooledCapbots.Empty();
+
+	Super::EndPlay(EndPlayReason);
+}
+APawn * ARaycastGameModeBase::SpawnDefaultPawnFor_Implementation(AController * NewPlayer, AActor * StartSpot)
+{
+	UClass * pawnClass = GetDefaultPawnClassForController(NewPlayer);
+	if (!bUseCapbotPool || !StartSpot || !pawnClass || !pawnClass->IsChildOf(ACapbot::StaticClass()))
+		return Super::SpawnDefaultPawnFor_Implementation(NewPlayer, StartSpot);
+
+	const FTransform transform(StartSpot->GetActorRotation(), StartSpot->GetActorLocation());
+	return AcquireCapbot(pawnClass, transform);
+}
+void ARaycastGameModeBase::Logout(AController * Exiting)
+{
+	// Controller would destroy its pawn, keep it
+	if (Exiting && bUseCapbotPool)
+		if (ACapbot * capbot = Cast<ACapbot>(Exiting->GetPawn()))
+			ReleaseCapbot(capbot);
+
+	Super::Logout(Exiting);
+}
+
+ACapbot * ARaycastGameModeBase::AcquireCapbot(TSubclassOf<ACapbot> capbotClass, const FTransform& transform)
+{
+	if (!capbotClass)
+		return nullptr;
+
+	const double startTime = FPlatformTime::Seconds();
+	++poolRequests;
+
+	ACapbot * capbot = nullptr;
+	for (int32 i = pooledCapbots.Num() - 1; i >= 0; --i)
+	{
+		ACapbot * pooled = pooledCapbots[i];
+		if (!pooled || pooled->IsPendingKillPending())
+		{
+			pooledCapbots.RemoveAtSwap(i);
+			continue;
+		}
+		if (pooled->GetClass() == *capbotClass)
+		{
+			pooledCapbots.RemoveAtSwap(i);
+			capbot = pooled;
+			break;
+		}
+	}
+
+	if (capbot)
+	{
+		++poolHits;
+		capbot->OnTakenFromPool(transform);
+	}
+	else
+	{
+		capbot = SpawnCapbot(capbotClass, transform);
+	}
+
+	spawnSecondsTotal += FPlatformTime::Seconds() - startTime;
+	return capbot;
+}
+void ARaycastGameModeBase::ReleaseCapbot(ACapbot * capbot)
+{
+	if (!capbot || capbot->IsPooled() || capbot->IsPendingKillPending())
+		return;
+
+	if (pooledCapbots.Num() >= poolMaxSize)
+	{
+		capbot->Destroy();
+		return;
+	}
+
+	// Marks pawn pooled first so UnPossessed doesn't come back here
+	capbot->OnReturnedToPool();
+	if (AController * controller = capbot->GetController())
+		controller->UnPossess();
+
+	pooledCapbots.Add(capbot);
+}
+ACapbot * ARaycastGameModeBase::SpawnCapbot(TSubclassOf<ACapbot> capbotClass, const FTransform& transform)
+{
+	FActorSpawnParameters spawnParameters;
+	spawnParameters.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+	spawnParameters.Instigator = Instigator;
+	spawnParameters.ObjectFlags |= RF_Transient;
+
+	return GetWorld()->SpawnActor<ACapbot>(capbotClass, transform, spawnParameters);
+}
+void ARaycastGameModeBase::WriteNetTelemetry()
+{
+	if (!netTelemetry.IsValid())
+		return;
+
+	// Real time, counters don't follow time dilation
+	const double now = FPlatformTime::Seconds();
+	const float sampleSeconds = (float)(now - lastTelemetryTime);
+	lastTelemetryTime = now;
+
+	TArray<FCapbotNetTelemetryRow> rows;
+	for (FConstPlayerControllerIterator it = GetWorld()->GetPlayerControllerIterator(); it; ++it)
+	{
+		APlayerController * controller = it->Get();
+		ACapbot * capbot = controller ? Cast<ACapbot>(controller->GetPawn()) : nullptr;
+		UCapbotMovementComponent * movement = capbot ? capbot->GetCapbotMovementComponent() : nullptr;
+		if (!movement)
+			continue;
+
+		FCapbotNetTelemetryRow& row = rows[rows.AddDefaulted()];
+		row.playerId = controller->PlayerState ? controller->PlayerState->PlayerId : -1;
+		row.address = controller->GetNetConnection() ? controller->GetNetConnection()->LowLevelGetRemoteAddress(true) : TEXT("local");
+		row.pawn = capbot->GetName();
+		row.roundTripTime = movement->GetRoundTripTime();
+		row.clockOffset = movement->GetClockOffset();
+		row.clockJitter = movement->GetClockJitter();
+		row.stats = movement->TakeNetStats();
+	}
+
+	netTelemetry->Write(GetWorld()->TimeSeconds, sampleSeconds, rows);
+}
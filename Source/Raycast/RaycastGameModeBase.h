@@ -6,6 +6,15 @@
 #include "GameFramework/GameModeBase.h"
 #include "RaycastGameModeBase.generated.h"
 
+class ACapbot;
+class FCapbotNetTelemetry;
+
+UENUM(BlueprintType)
+enum class ECapbotTelemetryFormat : uint8
+{
+	CSV, Prometheus
+};
+
 /**
  * 
  */
@@ -13,8 +22,76 @@ UCLASS()
 class RAYCAST_API ARaycastGameModeBase : public AGameModeBase
 {
 	GENERATED_BODY()
-	
-	
-	
-	
+
+public:
+	virtual void StartPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+	virtual APawn * SpawnDefaultPawnFor_Implementation(AController * NewPlayer, AActor * StartSpot) override;
+	virtual void Logout(AController * Exiting) override;
+
+	// Memory for all movement and compensation histories of the world
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, Category = "Capbot Movement")
+	int32 historyMemoryBudgetMB = 32;
+
+	/*
+	* Capbot pool. Pawns of default pawn class are taken from the pool on spawn
+	* and returned to it when unpossessed instead of being destroyed
+	*/
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, Category = "Capbot Pool")
+	bool bUseCapbotPool = true;
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, Category = "Capbot Pool")
+	bool bRecycleOnUnPossess = true;
+	// Pawns spawned at StartPlay
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, Category = "Capbot Pool")
+	int32 poolPrewarmSize = 16;
+	// Returned pawns above this are destroyed
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, Category = "Capbot Pool")
+	int32 poolMaxSize = 64;
+
+	/*
+	* Netcode telemetry. Every telemetryInterval a sample per possessed Capbot is written
+	* to Saved/Telemetry/<telemetryFileName>.csv (rotated) or .prom (replaced)
+	*/
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, Category = "Net Telemetry")
+	bool bExportNetTelemetry = false;
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, Category = "Net Telemetry")
+	ECapbotTelemetryFormat telemetryFormat = ECapbotTelemetryFormat::CSV;
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, Category = "Net Telemetry")
+	FString telemetryFileName = TEXT("NetTelemetry");
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, Category = "Net Telemetry")
+	float telemetryInterval = 1.f;
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, Category = "Net Telemetry")
+	int32 telemetryMaxFileMB = 16;
+	// Rotated CSV files kept besides the current one
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, Category = "Net Telemetry")
+	int32 telemetryFilesKept = 4;
+
+	UFUNCTION(BlueprintCallable, Category = "Capbot Pool")
+	ACapbot * AcquireCapbot(TSubclassOf<ACapbot> capbotClass, const FTransform& transform);
+	// Call on death to recycle the pawn, unpossessing it first if needed
+	UFUNCTION(BlueprintCallable, Category = "Capbot Pool")
+	void ReleaseCapbot(ACapbot * capbot);
+
+	UFUNCTION(BlueprintCallable, Category = "Capbot Pool")
+	float GetPoolHitRate() const { return poolRequests > 0 ? (float)poolHits / poolRequests : 0.f; }
+	// Average time taken by AcquireCapbot, hits and misses together
+	UFUNCTION(BlueprintCallable, Category = "Capbot Pool")
+	float GetAverageSpawnMilliseconds() const { return poolRequests > 0 ? (float)(spawnSecondsTotal * 1000.0 / poolRequests) : 0.f; }
+	UFUNCTION(BlueprintCallable, Category = "Capbot Pool")
+	int32 GetNumPooledCapbots() const { return pooledCapbots.Num(); }
+
+protected:
+	ACapbot * SpawnCapbot(TSubclassOf<ACapbot> capbotClass, const FTransform& transform);
+	void WriteNetTelemetry();
+
+	UPROPERTY(Transient)
+	TArray<ACapbot*> pooledCapbots;
+
+	int32 poolRequests = 0;
+	int32 poolHits = 0;
+	double spawnSecondsTotal = 0.0;
+
+	TSharedPtr<FCapbotNetTelemetry> netTelemetry;
+	FTimerHandle netTelemetryTimer;
+	double lastTelemetryTime = 0.0;
 };